@@ -0,0 +1,240 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include <ldap.h>
+
+#include <QElapsedTimer>
+
+#include "LdapProbe.h"
+
+// ldap_connect() only exists since OpenLDAP 2.5, before the connection is opened by the bind
+#if defined(LDAP_VENDOR_VERSION) && LDAP_VENDOR_VERSION >= 20500
+#define LDAP_HAS_CONNECT
+#endif
+
+static const int timeout_secs = 5;
+
+// RFC 4515 escaping of an assertion value, the probed user matches literally
+static QString escapeFilterValue(const QString& value) {
+
+  QString escaped;
+  escaped.reserve(value.size());
+
+  for( int i = 0; i < value.size(); i++ ) {
+
+    QChar c = value.at(i);
+
+    switch( c.unicode() ) {
+      case '*': escaped += "\\2a"; break;
+      case '(': escaped += "\\28"; break;
+      case ')': escaped += "\\29"; break;
+      case '\\': escaped += "\\5c"; break;
+      case 0: escaped += "\\00"; break;
+      default: escaped += c;
+    }
+  }
+
+  return escaped;
+}
+
+LdapProbe::LdapProbe(const QVariantMap& properties) :
+  found(0), failed(0) {
+
+  // the core builds the server uri the same way
+  uri = ( properties.value("Hostname").toString() + ":" + properties.value("Port").toString() ).toLocal8Bit();
+  base_dn = properties.value("BaseDN").toString().toUtf8();
+  bind_dn = properties.value("BindDN").toString().toUtf8();
+  bind_password = properties.value("BindPassword").toString().toUtf8();
+  filter = properties.value("Filter").toString();
+  uid_attribute = properties.value("UidAttribute").toString();
+}
+
+bool LdapProbe::run(int rounds, const QString& uid) {
+
+  QString condition = filter.startsWith('(') ? filter : "(" + filter + ")";
+  QString search = QString("(&(%1=%2)%3)").arg(uid_attribute, uid.isEmpty() ? "*" : escapeFilterValue(uid), condition);
+
+  connect_times.clear();
+  bind_times.clear();
+  search_times.clear();
+  found = 0;
+  failed = 0;
+
+  for( int i = 0; i < rounds; i++ ) {
+
+    if( !probe(search.toUtf8()) )
+      failed++;
+  }
+
+  return failed == 0 && found == rounds;
+}
+
+bool LdapProbe::probe(const QByteArray& search) {
+
+  QElapsedTimer timer;
+  LDAP* ld = nullptr;
+
+  timer.start();
+
+  int result = ldap_initialize(&ld, uri.constData());
+
+  if( result != LDAP_SUCCESS ) {
+    printError("initialize", result);
+    return false;
+  }
+
+  int protocol = LDAP_VERSION3;
+  struct timeval timeout = { timeout_secs, 0 };
+
+  ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &protocol);
+  ldap_set_option(ld, LDAP_OPT_NETWORK_TIMEOUT, &timeout);
+  ldap_set_option(ld, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
+
+#ifdef LDAP_HAS_CONNECT
+  result = ldap_connect(ld);
+
+  if( result != LDAP_SUCCESS ) {
+    printError("connect", result);
+    ldap_unbind_ext_s(ld, nullptr, nullptr);
+    return false;
+  }
+#endif
+
+  qint64 connect_time = timer.nsecsElapsed() / 1000;
+
+  timer.restart();
+
+  struct berval credentials;
+  credentials.bv_val = const_cast<char*>(bind_password.constData());
+  credentials.bv_len = bind_password.size();
+
+  result = ldap_sasl_bind_s(ld, bind_dn.constData(), LDAP_SASL_SIMPLE, &credentials, nullptr, nullptr, nullptr);
+
+  if( result != LDAP_SUCCESS ) {
+    printError("bind", result);
+    ldap_unbind_ext_s(ld, nullptr, nullptr);
+    return false;
+  }
+
+  qint64 bind_time = timer.nsecsElapsed() / 1000;
+
+  timer.restart();
+
+  QByteArray attribute = uid_attribute.toUtf8();
+  char* attributes[] = { attribute.data(), nullptr };
+  LDAPMessage* message = nullptr;
+
+  result = ldap_search_ext_s(ld, base_dn.constData(), LDAP_SCOPE_SUBTREE, search.constData(),
+                             attributes, 1, nullptr, nullptr, &timeout, 1, &message);
+
+  qint64 search_time = timer.nsecsElapsed() / 1000;
+
+  // a size limit of one entry is hit as soon as more than one user matches
+  bool success = ( result == LDAP_SUCCESS || result == LDAP_SIZELIMIT_EXCEEDED );
+
+  if( success && message != nullptr && ldap_count_entries(ld, message) > 0 )
+    found++;
+
+  if( message != nullptr )
+    ldap_msgfree(message);
+
+  ldap_unbind_ext_s(ld, nullptr, nullptr);
+
+  if( !success ) {
+    printError("search", result);
+    return false;
+  }
+
+  connect_times.append(connect_time);
+  bind_times.append(bind_time);
+  search_times.append(search_time);
+
+  return true;
+}
+
+void LdapProbe::printError(const char* step, int result) const {
+
+  std::cerr
+    << std::endl
+    << "ERROR: "
+    << "LDAP " << step << " against " << uri.constData() << " failed"
+    << std::endl
+    << "-"
+    << ldap_err2string(result)
+    << std::endl;
+}
+
+/**
+ * nearest rank percentiles in milliseconds
+ */
+static void printPercentiles(std::ostream& out, const char* name, QVector<qint64> times) {
+
+  // the manipulators stick to the stream of the caller
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+
+  out << "  " << std::left << std::setw(8) << name << std::right;
+
+  if( times.isEmpty() ) {
+    out << " n/a" << std::endl;
+    out.flags(flags);
+    return;
+  }
+
+  std::sort(times.begin(), times.end());
+
+  const int percentiles[] = { 50, 90, 99 };
+
+  for( int p : percentiles ) {
+    int rank = qMax(1, ( p * times.size() + 99 ) / 100);
+
+    out << "  p" << p << ": " << std::fixed << std::setprecision(2) << times.at(rank - 1) / 1000.0 << " ms";
+  }
+
+  out << "  max: " << times.last() / 1000.0 << " ms" << std::endl;
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+void LdapProbe::report(std::ostream& out) const {
+
+  out
+    << std::endl
+    << "LDAP probe of " << uri.constData() << ": "
+    << connect_times.size() << " successful rounds, "
+    << failed << " failed, "
+    << found << " with a matching user"
+    << std::endl;
+
+#ifdef LDAP_HAS_CONNECT
+  printPercentiles(out, "connect", connect_times);
+#else
+  out << "  connect  (part of bind, this libldap has no ldap_connect())" << std::endl;
+#endif
+  printPercentiles(out, "bind", bind_times);
+  printPercentiles(out, "search", search_times);
+
+  out << std::endl;
+}
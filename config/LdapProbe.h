@@ -0,0 +1,70 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef LDAPPROBE_H
+#define LDAPPROBE_H
+
+#include <ostream>
+
+#include <QByteArray>
+#include <QString>
+#include <QVariantMap>
+#include <QVector>
+
+/*
+ * Checks LDAP AuthProperties the way the core uses them, before they are
+ * written: connect to Hostname:Port, bind with BindDN and look up a user
+ * through UidAttribute and Filter below BaseDN.
+ *
+ * Every round uses a fresh connection, so the latencies are what a login
+ * on the core sees.
+ */
+class LdapProbe {
+
+public:
+    LdapProbe(const QVariantMap& properties);
+
+    // uid is the user to look up, any user matching the filter if empty
+    bool run(int rounds, const QString& uid = QString());
+    void report(std::ostream& out) const;
+
+    int failures() const { return failed; }
+
+private:
+
+    bool probe(const QByteArray& filter);
+    void printError(const char* step, int result) const;
+
+    QByteArray uri;
+    QByteArray base_dn;
+    QByteArray bind_dn;
+    QByteArray bind_password;
+    QString filter;
+    QString uid_attribute;
+
+    // usecs of every successful round
+    QVector<qint64> connect_times;
+    QVector<qint64> bind_times;
+    QVector<qint64> search_times;
+    int found;
+    int failed;
+};
+
+#endif // LDAPPROBE_H
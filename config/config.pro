@@ -21,6 +21,9 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 # Input
-SOURCES += main.cpp
+SOURCES += main.cpp LdapProbe.cpp
+HEADERS += LdapProbe.h
+
+LIBS += -lldap
 
 QMAKE_CXXFLAGS += -std=c++0x
@@ -15,6 +15,8 @@
 #include <QJsonObject>
 #include <QFile>
 
+#include <LdapProbe.h>
+
 const char *progname = "quasselcore-config";
 const char *version = "1.0.1";
 const char *copyright = "2019";
@@ -28,15 +30,21 @@ void print_usage (void);
 int main(int argc, char *argv[]) {
 
   bool dump_config_file = false;
+  bool probe = false;
+  int probe_rounds = 10;
+  QString probe_user;
   QString config_file;
 
   int opt = 0;
-  const char* const short_opts = "hVdf:";
+  const char* const short_opts = "hVdf:pr:u:";
   const option long_opts[] = {
     {"help"   , no_argument      , nullptr, 'h'},
     {"version", no_argument      , nullptr, 'V'},
     {"dump"   , no_argument      , nullptr, 'd'},
     {"file"   , required_argument, nullptr, 'f'},
+    {"probe"     , no_argument      , nullptr, 'p'},
+    {"rounds"    , required_argument, nullptr, 'r'},
+    {"probe-user", required_argument, nullptr, 'u'},
     {nullptr  , 0, nullptr, 0}
   };
 
@@ -59,6 +67,15 @@ int main(int argc, char *argv[]) {
       case 'f':
         config_file = optarg;
         break;
+      case 'p':
+        probe = true;
+        break;
+      case 'r':
+        probe_rounds = QString(optarg).toInt();
+        break;
+      case 'u':
+        probe_user = QString::fromUtf8(optarg);
+        break;
       default:
         print_usage();
         return 1;
@@ -76,6 +93,14 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if( probe && probe_rounds <= 0 ) {
+    print_usage();
+    std::cerr
+      << "the probe needs at least one round.\n"
+      << std::endl;
+    return 1;
+  }
+
   if( QFile(config_file).exists() == false ) {
     print_usage();
     std::cerr
@@ -141,13 +166,20 @@ int main(int argc, char *argv[]) {
 
   // ----------------
 
-  if(ldap_bind_dn.isEmpty()) {
+  if(ldap_base_dn.isEmpty()) {
     ldpa_config_valid = false;
     ss
       << " - LDAP_BASE_DN missing"
       << std::endl;
   }
 
+  if(ldap_bind_dn.isEmpty()) {
+    ldpa_config_valid = false;
+    ss
+      << " - LDAP_BIND_DN missing"
+      << std::endl;
+  }
+
   if(ldap_bind_password.isEmpty()) {
     ldpa_config_valid = false;
     ss
@@ -194,7 +226,7 @@ int main(int argc, char *argv[]) {
       << ss.str()
       << std::endl;
 
-    return 0;
+    return probe ? 1 : 0;
   }
 
   QVariantMap map;
@@ -208,6 +240,25 @@ int main(int argc, char *argv[]) {
   map2.insert("Port"         , ldap_port);
   map2.insert("UidAttribute" , ldap_uid_attribute);
 
+  if( probe ) {
+
+    LdapProbe ldap(map2);
+
+    bool success = ldap.run(probe_rounds, probe_user);
+    ldap.report(std::cout);
+
+    if( !success ) {
+      std::cout
+        << "WARNING:"
+        << std::endl
+        << "The LDAP configuration was not written because the probe "
+        << ( ldap.failures() > 0 ? "failed." : "found no matching user." )
+        << std::endl;
+
+      return 1;
+    }
+  }
+
   map.insert("Authenticator", "LDAP");
   map.insert("AuthProperties", map2);
 
@@ -249,7 +300,14 @@ void print_help (void) {
     << " -f, --file" << std::endl
     << "    config file." << std::endl
     << " -d, --dump" << std::endl
-    << "    dump content config file" << std::endl;
+    << "    dump content config file" << std::endl
+    << " -p, --probe" << std::endl
+    << "    connect, bind and look up a user with the LDAP settings and report the latencies," << std::endl
+    << "    the configuration is only written if every round succeeds" << std::endl
+    << " -r, --rounds <count>" << std::endl
+    << "    number of probe rounds (default: 10)" << std::endl
+    << " -u, --probe-user <uid>" << std::endl
+    << "    the user the probe looks up (default: any user matching LDAP_FILTER)" << std::endl;
 }
 
 /**
@@ -259,5 +317,6 @@ void print_usage (void) {
   std::cout << std::endl;
   std::cout << "Usage:" << std::endl;
   std::cout << " " << progname << " [-file <config file>] --dump"  << std::endl;
+  std::cout << " " << progname << " [-file <config file>] [--probe [--rounds <count>] [--probe-user <uid>]]"  << std::endl;
   std::cout << std::endl;
 }
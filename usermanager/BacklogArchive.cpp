@@ -0,0 +1,337 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include "BacklogArchive.h"
+#include "QuasselSchema.h"
+
+// the same sender tuple in another database, NULL columns included
+#define SAME_SENDER(a, b) a ".sender = " b ".sender AND " a ".realname IS " b ".realname AND " a ".avatarurl IS " b ".avatarurl"
+
+BacklogArchive::BacklogArchive(SqliteNative& database, const QString& file, int size) :
+  db(database), archive_file(file), batch_size(size), time_divisor(0),
+  moved_rows(0), freed_pages(0), page_size(0), page_count(0), freelist_count(0) {
+}
+
+bool BacklogArchive::attach() {
+
+  if( !db.attach(archive_file, "archive") )
+    return false;
+
+  return db.exec("CREATE TABLE IF NOT EXISTS archive.backlog ("
+                 "  messageid INTEGER PRIMARY KEY, time INTEGER NOT NULL, bufferid INTEGER NOT NULL, type INTEGER NOT NULL,"
+                 "  flags INTEGER NOT NULL, senderid INTEGER NOT NULL, senderprefixes TEXT, message TEXT)") &&
+         db.exec("CREATE INDEX IF NOT EXISTS archive.backlog_bufferid_idx ON backlog(bufferid, messageid)") &&
+         db.exec("CREATE INDEX IF NOT EXISTS archive.backlog_time_idx ON backlog(time)") &&
+         db.exec("CREATE TABLE IF NOT EXISTS archive.sender (senderid INTEGER PRIMARY KEY, sender TEXT NOT NULL, realname TEXT, avatarurl TEXT)") &&
+         db.exec("CREATE UNIQUE INDEX IF NOT EXISTS archive.sender_sender_realname_avatarurl_idx ON sender(sender, realname, avatarurl)") &&
+         db.exec("CREATE TABLE IF NOT EXISTS archive.buffer (bufferid INTEGER PRIMARY KEY, userid INTEGER NOT NULL, buffername TEXT NOT NULL, buffercname TEXT NOT NULL)");
+}
+
+qint64 BacklogArchive::toBacklogTime(qint64 msecs) {
+
+  if( time_divisor == 0 )
+    time_divisor = backlogTimeDivisor(db);
+
+  return msecs / time_divisor;
+}
+
+void BacklogArchive::startReport() {
+
+  moved_rows = 0;
+  freed_pages = 0;
+  page_size = db.pragma("main.page_size");
+  page_count = db.pragma("main.page_count");
+  freelist_count = db.pragma("main.freelist_count");
+}
+
+void BacklogArchive::finishReport() {
+
+  // with auto_vacuum = INCREMENTAL the free pages can be handed back right away
+  if( db.pragma("main.auto_vacuum") == 2 )
+    db.exec("PRAGMA main.incremental_vacuum");
+
+  freed_pages = ( page_count - db.pragma("main.page_count") ) + ( db.pragma("main.freelist_count") - freelist_count );
+}
+
+/**
+ * the next batch_size lines after cursor, below the newest line
+ */
+bool BacklogArchive::window(qint64 cursor, qint64& end, qint64& rows, qint64& min_time) {
+
+  SqliteStatement* window = db.statement(
+    "SELECT max(messageid), count(*), min(time) FROM ("
+    "  SELECT messageid, time FROM main.backlog"
+    "   WHERE messageid > ?1 AND messageid < (SELECT max(messageid) FROM main.backlog)"
+    "   ORDER BY messageid LIMIT ?2)");
+
+  if( window == nullptr )
+    return false;
+
+  window->bind(1, cursor);
+  window->bind(2, qint64(batch_size));
+
+  end = 0;
+  rows = 0;
+  min_time = 0;
+
+  if( window->next() ) {
+    end = window->columnInt64(0);
+    rows = window->columnInt64(1);
+    min_time = window->columnInt64(2);
+  }
+
+  bool success = ( window->lastResult() == SQLITE_ROW || window->lastResult() == SQLITE_DONE );
+  window->reset();
+
+  return success;
+}
+
+/**
+ * walk the whole backlog in messageid windows of batch_size lines and move
+ * the lines older than the cutoff
+ *
+ * messageids do not follow time, --import writes old history at the top,
+ * so no window ends the run early. The windows are read without the write
+ * lock first, only windows with old lines take it and are read again.
+ *
+ * the newest line always stays: messageid has no AUTOINCREMENT, so the
+ * core would hand out the ids of moved top lines again, they would collide
+ * with the archive and land below lastseenmsgid of their buffer
+ */
+bool BacklogArchive::archive(qint64 before, uint userid) {
+
+  startReport();
+
+  qint64 cutoff = toBacklogTime(before);
+  qint64 cursor = 0;
+
+  forever {
+
+    qint64 window_end = 0;
+    qint64 rows = 0;
+    qint64 min_time = 0;
+
+    if( !window(cursor, window_end, rows, min_time) )
+      return false;
+
+    if( rows == 0 )
+      break;
+
+    if( min_time >= cutoff ) {
+      cursor = window_end;
+      continue;
+    }
+
+    if( !db.transaction() )
+      return false;
+
+    SqliteStatement* buffers = db.statement(
+      "INSERT OR REPLACE INTO archive.buffer (bufferid, userid, buffername, buffercname)"
+      "  SELECT bufferid, userid, buffername, buffercname FROM main.buffer"
+      "   WHERE bufferid IN (SELECT DISTINCT bufferid FROM main.backlog WHERE messageid > ?1 AND messageid <= ?2 AND time < ?3)"
+      "     AND (?4 = 0 OR userid = ?4)");
+    SqliteStatement* senders = db.statement(
+      "INSERT INTO archive.sender (sender, realname, avatarurl)"
+      "  SELECT DISTINCT s.sender, s.realname, s.avatarurl"
+      "    FROM main.backlog b JOIN main.sender s ON s.senderid = b.senderid"
+      "   WHERE b.messageid > ?1 AND b.messageid <= ?2 AND b.time < ?3"
+      "     AND (?4 = 0 OR b.bufferid IN (SELECT bufferid FROM main.buffer WHERE userid = ?4))"
+      "     AND NOT EXISTS (SELECT 1 FROM archive.sender a WHERE " SAME_SENDER("a", "s") ")");
+    SqliteStatement* lines = db.statement(
+      "INSERT INTO archive.backlog (messageid, time, bufferid, type, flags, senderid, senderprefixes, message)"
+      "  SELECT b.messageid, b.time, b.bufferid, b.type, b.flags,"
+      "         (SELECT a.senderid FROM archive.sender a WHERE " SAME_SENDER("a", "s") "),"
+      "         b.senderprefixes, b.message"
+      "    FROM main.backlog b JOIN main.sender s ON s.senderid = b.senderid"
+      "   WHERE b.messageid > ?1 AND b.messageid <= ?2 AND b.time < ?3"
+      "     AND (?4 = 0 OR b.bufferid IN (SELECT bufferid FROM main.buffer WHERE userid = ?4))"
+      "   ORDER BY b.messageid");
+    SqliteStatement* remove = db.statement(
+      "DELETE FROM main.backlog"
+      " WHERE messageid > ?1 AND messageid <= ?2 AND time < ?3"
+      "   AND messageid IN (SELECT messageid FROM archive.backlog WHERE messageid > ?1 AND messageid <= ?2)");
+
+    if( buffers == nullptr || senders == nullptr || lines == nullptr || remove == nullptr ||
+        !window(cursor, window_end, rows, min_time) ) {
+      db.rollback();
+      return false;
+    }
+
+    if( rows == 0 ) {
+      db.rollback();
+      break;
+    }
+
+    SqliteStatement* steps[] = { buffers, senders, lines };
+    bool success = true;
+
+    for( SqliteStatement* step : steps ) {
+      step->bind(1, cursor);
+      step->bind(2, window_end);
+      step->bind(3, cutoff);
+      step->bind(4, qint64(userid));
+      success = success && step->exec();
+    }
+
+    remove->bind(1, cursor);
+    remove->bind(2, window_end);
+    remove->bind(3, cutoff);
+
+    if( !success || !remove->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to archive the backlog after messageid " << cursor
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+
+    moved_rows += db.numRowsAffected();
+
+    if( !db.commit() )
+      return false;
+
+    cursor = window_end;
+  }
+
+  finishReport();
+
+  return true;
+}
+
+/**
+ * move archived lines of a time range back in messageid ordered batches,
+ * lines of buffers that no longer exist stay in the archive
+ */
+bool BacklogArchive::restore(qint64 from, qint64 to, uint userid) {
+
+  startReport();
+
+  qint64 begin = toBacklogTime(from);
+  qint64 end = toBacklogTime(to);
+  qint64 cursor = 0;
+
+  forever {
+
+    if( !db.transaction() )
+      return false;
+
+    SqliteStatement* batch = db.statement(
+      "SELECT max(messageid), count(*) FROM ("
+      "  SELECT messageid FROM archive.backlog"
+      "   WHERE messageid > ?1 AND time >= ?2 AND time < ?3"
+      "     AND (?4 = 0 OR bufferid IN (SELECT bufferid FROM archive.buffer WHERE userid = ?4))"
+      "   ORDER BY messageid LIMIT ?5)");
+    SqliteStatement* senders = db.statement(
+      "INSERT INTO main.sender (sender, realname, avatarurl)"
+      "  SELECT DISTINCT s.sender, s.realname, s.avatarurl"
+      "    FROM archive.backlog b JOIN archive.sender s ON s.senderid = b.senderid"
+      "   WHERE b.messageid > ?1 AND b.messageid <= ?2 AND b.time >= ?3 AND b.time < ?4"
+      "     AND NOT EXISTS (SELECT 1 FROM main.sender m WHERE " SAME_SENDER("m", "s") ")");
+    SqliteStatement* lines = db.statement(
+      "INSERT INTO main.backlog (messageid, time, bufferid, type, flags, senderid, senderprefixes, message)"
+      "  SELECT b.messageid, b.time, b.bufferid, b.type, b.flags,"
+      "         (SELECT m.senderid FROM main.sender m WHERE " SAME_SENDER("m", "s") "),"
+      "         b.senderprefixes, b.message"
+      "    FROM archive.backlog b"
+      "    JOIN archive.sender s ON s.senderid = b.senderid"
+      "    JOIN main.buffer buf ON buf.bufferid = b.bufferid"
+      "   WHERE b.messageid > ?1 AND b.messageid <= ?2 AND b.time >= ?3 AND b.time < ?4"
+      "     AND (?5 = 0 OR buf.userid = ?5)"
+      "   ORDER BY b.messageid");
+    SqliteStatement* remove = db.statement(
+      "DELETE FROM archive.backlog"
+      " WHERE messageid > ?1 AND messageid <= ?2"
+      "   AND messageid IN (SELECT messageid FROM main.backlog WHERE messageid > ?1 AND messageid <= ?2)");
+
+    if( batch == nullptr || senders == nullptr || lines == nullptr || remove == nullptr ) {
+      db.rollback();
+      return false;
+    }
+
+    batch->bind(1, cursor);
+    batch->bind(2, begin);
+    batch->bind(3, end);
+    batch->bind(4, qint64(userid));
+    batch->bind(5, qint64(batch_size));
+
+    qint64 batch_end = 0;
+    qint64 rows = 0;
+
+    if( batch->next() ) {
+      batch_end = batch->columnInt64(0);
+      rows = batch->columnInt64(1);
+    }
+    batch->reset();
+
+    if( rows == 0 ) {
+      db.rollback();
+      break;
+    }
+
+    senders->bind(1, cursor);
+    senders->bind(2, batch_end);
+    senders->bind(3, begin);
+    senders->bind(4, end);
+
+    lines->bind(1, cursor);
+    lines->bind(2, batch_end);
+    lines->bind(3, begin);
+    lines->bind(4, end);
+    lines->bind(5, qint64(userid));
+
+    remove->bind(1, cursor);
+    remove->bind(2, batch_end);
+
+    bool success = senders->exec() && lines->exec();
+    qint64 restored = db.numRowsAffected();
+
+    if( !success || !remove->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to restore the backlog after messageid " << cursor
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+
+    if( !db.commit() )
+      return false;
+
+    moved_rows += restored;
+    cursor = batch_end;
+  }
+
+  finishReport();
+
+  return true;
+}
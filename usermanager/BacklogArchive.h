@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef BACKLOGARCHIVE_H
+#define BACKLOGARCHIVE_H
+
+#include <QString>
+
+#include "SqliteNative.h"
+
+/*
+ * Moves old backlog into a separate SQLite file and back.
+ *
+ * The archive has its own sender table, senders are matched by value on
+ * both sides, so the archive stays consistent no matter which sender rows
+ * the hot database reuses or collects in the meantime. Buffer names are
+ * copied along to keep the archive readable on its own.
+ */
+class BacklogArchive {
+
+public:
+    BacklogArchive(SqliteNative& db, const QString& archive_file, int batch_size = 5000);
+
+    bool attach();
+
+    // times are msecs since epoch, userid 0 means all users
+    bool archive(qint64 before, uint userid = 0);
+    bool restore(qint64 from, qint64 to, uint userid = 0);
+
+    qint64 movedRows() const { return moved_rows; }
+    qint64 freedPages() const { return freed_pages; }
+    qint64 pageSize() const { return page_size; }
+
+private:
+
+    qint64 toBacklogTime(qint64 msecs);
+    bool window(qint64 cursor, qint64& end, qint64& rows, qint64& min_time);
+    void startReport();
+    void finishReport();
+
+    SqliteNative& db;
+    QString archive_file;
+    int batch_size;
+
+    qint64 time_divisor;
+
+    qint64 moved_rows;
+    qint64 freed_pages;
+    qint64 page_size;
+    qint64 page_count;
+    qint64 freelist_count;
+};
+
+#endif // BACKLOGARCHIVE_H
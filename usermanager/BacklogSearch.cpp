@@ -0,0 +1,291 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include "BacklogSearch.h"
+#include "QuasselSchema.h"
+
+// the layout of the index file, older ones are rebuilt
+static const int index_version = 1;
+
+BacklogSearch::BacklogSearch(SqliteNative& database, const QString& file, int size) :
+  db(database), index_file(file), batch_size(size), indexed_rows(0) {
+}
+
+bool BacklogSearch::attach() {
+
+  if( !db.attach(index_file, "search") )
+    return false;
+
+  // the index only holds derived data, an index of another layout starts over
+  if( db.pragma("search.user_version") != index_version ) {
+
+    if( !db.exec("DROP TABLE IF EXISTS search.backlog_fts") ||
+        !db.exec("DROP TABLE IF EXISTS search.fts_rows") ||
+        !db.exec("DROP TABLE IF EXISTS search.fts_state") )
+      return false;
+
+    QByteArray version = QByteArray("PRAGMA search.user_version = ") + QByteArray::number(index_version);
+
+    if( !db.exec(version.constData()) )
+      return false;
+  }
+
+  return db.exec("CREATE VIRTUAL TABLE IF NOT EXISTS search.backlog_fts USING fts5(message, content='')") &&
+         db.exec("CREATE TABLE IF NOT EXISTS search.fts_rows ("
+                 "  docid INTEGER PRIMARY KEY AUTOINCREMENT, messageid INTEGER NOT NULL,"
+                 "  bufferid INTEGER NOT NULL, time INTEGER NOT NULL)") &&
+         db.exec("CREATE INDEX IF NOT EXISTS search.fts_rows_messageid_idx ON fts_rows(messageid)") &&
+         db.exec("CREATE TABLE IF NOT EXISTS search.fts_state ("
+                 "  bufferid INTEGER PRIMARY KEY, last_messageid INTEGER NOT NULL, last_time INTEGER NOT NULL)");
+}
+
+bool BacklogSearch::update(uint userid, const QString& buffer) {
+
+  QVector<qint64> buffers;
+  indexed_rows = 0;
+
+  if( !scopeBuffers(userid, buffer, buffers) )
+    return false;
+
+  for( qint64 bufferid : buffers ) {
+
+    if( !updateBuffer(bufferid) )
+      return false;
+  }
+
+  return true;
+}
+
+bool BacklogSearch::scopeBuffers(uint userid, const QString& buffer, QVector<qint64>& buffers) {
+
+  SqliteStatement* query = db.statement("SELECT bufferid FROM buffer WHERE (?1 = 0 OR userid = ?1) AND (?2 = '' OR buffercname = ?2) ORDER BY bufferid");
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, qint64(userid));
+  query->bind(2, buffer.toLower());
+
+  while( query->next() )
+    buffers.append(query->columnInt64(0));
+
+  bool success = ( query->lastResult() == SQLITE_DONE );
+  query->reset();
+
+  return success;
+}
+
+/**
+ * index the lines of one buffer in messageid order, every batch commits
+ * the lines together with the new watermark of the buffer
+ *
+ * when the watermark line is gone or another line has its messageid, the
+ * newest lines were deleted and the core reused their ids: the update goes
+ * back to the last older line, lines that are still indexed are skipped
+ */
+bool BacklogSearch::updateBuffer(qint64 bufferid) {
+
+  SqliteStatement* state = db.statement("SELECT last_messageid, last_time FROM search.fts_state WHERE bufferid = ?1");
+
+  if( state == nullptr )
+    return false;
+
+  state->bind(1, bufferid);
+
+  qint64 last_messageid = 0;
+  qint64 last_time = 0;
+
+  if( state->next() ) {
+    last_messageid = state->columnInt64(0);
+    last_time = state->columnInt64(1);
+  }
+  state->reset();
+
+  if( last_messageid > 0 ) {
+
+    SqliteStatement* line = db.statement("SELECT time FROM backlog WHERE messageid = ?1 AND bufferid = ?2");
+    SqliteStatement* back = db.statement(
+      "SELECT coalesce(max(messageid), 0) FROM backlog WHERE bufferid = ?1 AND messageid <= ?2 AND time < ?3");
+
+    if( line == nullptr || back == nullptr )
+      return false;
+
+    line->bind(1, last_messageid);
+    line->bind(2, bufferid);
+    bool same = line->next() && line->columnInt64(0) == last_time;
+    line->reset();
+
+    if( !same ) {
+      back->bind(1, bufferid);
+      back->bind(2, last_messageid);
+      back->bind(3, last_time);
+      last_messageid = back->next() ? back->columnInt64(0) : 0;
+      back->reset();
+    }
+  }
+
+  forever {
+
+    // deferred, only the index database is written to
+    if( !db.transaction(false) )
+      return false;
+
+    SqliteStatement* batch = db.statement(
+      "SELECT max(messageid), count(*) FROM ("
+      "  SELECT messageid FROM backlog WHERE bufferid = ?1 AND messageid > ?2 ORDER BY messageid LIMIT ?3)");
+    SqliteStatement* rows_insert = db.statement(
+      "INSERT INTO search.fts_rows (messageid, bufferid, time)"
+      "  SELECT b.messageid, b.bufferid, b.time FROM backlog b"
+      "   WHERE b.bufferid = ?1 AND b.messageid > ?2 AND b.messageid <= ?3"
+      "     AND NOT EXISTS (SELECT 1 FROM search.fts_rows r"
+      "                      WHERE r.messageid = b.messageid AND r.bufferid = b.bufferid AND r.time = b.time)"
+      "   ORDER BY b.messageid");
+    SqliteStatement* insert = db.statement(
+      "INSERT INTO search.backlog_fts (rowid, message)"
+      "  SELECT r.docid, b.message FROM search.fts_rows r JOIN backlog b ON b.messageid = r.messageid"
+      "   WHERE r.docid > ?1 AND r.docid <= ?2");
+    SqliteStatement* watermark = db.statement(
+      "INSERT OR REPLACE INTO search.fts_state (bufferid, last_messageid, last_time)"
+      "  SELECT ?1, ?2, time FROM backlog WHERE messageid = ?2");
+
+    if( batch == nullptr || rows_insert == nullptr || insert == nullptr || watermark == nullptr ) {
+      db.rollback();
+      return false;
+    }
+
+    batch->bind(1, bufferid);
+    batch->bind(2, last_messageid);
+    batch->bind(3, qint64(batch_size));
+
+    qint64 max_messageid = 0;
+    qint64 rows = 0;
+
+    if( batch->next() ) {
+      max_messageid = batch->columnInt64(0);
+      rows = batch->columnInt64(1);
+    }
+    batch->reset();
+
+    if( rows == 0 ) {
+      db.rollback();
+      break;
+    }
+
+    rows_insert->bind(1, bufferid);
+    rows_insert->bind(2, last_messageid);
+    rows_insert->bind(3, max_messageid);
+
+    bool success = rows_insert->exec();
+
+    // the new document ids are the last ones handed out
+    qint64 last_docid = db.lastInsertId();
+    qint64 new_docs = db.numRowsAffected();
+
+    insert->bind(1, last_docid - new_docs);
+    insert->bind(2, last_docid);
+
+    watermark->bind(1, bufferid);
+    watermark->bind(2, max_messageid);
+
+    if( !success || ( new_docs > 0 && !insert->exec() ) || !watermark->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to index buffer " << bufferid
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+
+    if( !db.commit() )
+      return false;
+
+    indexed_rows += rows;
+    last_messageid = max_messageid;
+
+    if( rows < batch_size )
+      break;
+  }
+
+  return true;
+}
+
+/**
+ * lines removed from the backlog since they were indexed, and lines that
+ * reuse their messageid, drop out of the join, newest matches first
+ */
+bool BacklogSearch::search(const QString& query, QList<BacklogSearchResult>& results, uint userid, const QString& buffer, int limit) {
+
+  SqliteStatement* select = db.statement(
+    "SELECT b.messageid, b.time, buf.buffername, s.sender, b.message"
+    "  FROM search.backlog_fts f"
+    "  JOIN search.fts_rows r ON r.docid = f.rowid"
+    "  JOIN backlog b ON b.messageid = r.messageid AND b.bufferid = r.bufferid AND b.time = r.time"
+    "  JOIN buffer buf ON buf.bufferid = b.bufferid"
+    "  JOIN sender s ON s.senderid = b.senderid"
+    " WHERE backlog_fts MATCH ?1"
+    "   AND (?2 = 0 OR buf.userid = ?2)"
+    "   AND (?3 = '' OR buf.buffercname = ?3)"
+    " ORDER BY f.rowid DESC LIMIT ?4");
+
+  if( select == nullptr )
+    return false;
+
+  select->bind(1, query);
+  select->bind(2, qint64(userid));
+  select->bind(3, buffer.toLower());
+  select->bind(4, limit);
+
+  // pre-0.13 schemas store seconds
+  qint64 time_factor = backlogTimeDivisor(db);
+
+  while( select->next() ) {
+    BacklogSearchResult result;
+    result.messageid = select->columnInt64(0);
+    result.time = select->columnInt64(1) * time_factor;
+    result.buffer = select->columnText(2);
+    result.sender = select->columnText(3);
+    result.message = select->columnText(4);
+    results.append(result);
+  }
+
+  bool success = ( select->lastResult() == SQLITE_DONE );
+
+  if( !success ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "search failed"
+      << std::endl
+      << "-"
+      << db.lastError().toStdString()
+      << std::endl;
+  }
+
+  select->reset();
+
+  return success;
+}
@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef BACKLOGSEARCH_H
+#define BACKLOGSEARCH_H
+
+#include <QList>
+#include <QString>
+#include <QVector>
+
+#include "SqliteNative.h"
+
+struct BacklogSearchResult {
+    qint64 messageid;
+    qint64 time;        // msecs since epoch
+    QString buffer;
+    QString sender;
+    QString message;
+};
+
+/*
+ * FTS5 index over backlog.message in a separate database file.
+ *
+ * The index is contentless, the lines themselves are read from the backlog
+ * table. A contentless index can not drop a line without its text, so every
+ * indexed line gets its own document id in fts_rows together with its
+ * messageid, buffer and time: a hit only counts while the backlog line with
+ * that messageid still has the same buffer and time, lines that were deleted
+ * or whose messageid the core reused drop out of the join.
+ *
+ * For every buffer the last indexed messageid is kept, so an update only
+ * reads the lines written since the previous run. The core database is
+ * never written to.
+ */
+class BacklogSearch {
+
+public:
+    BacklogSearch(SqliteNative& db, const QString& index_file, int batch_size = 5000);
+
+    bool attach();
+
+    // userid 0 means all users, an empty buffer name all buffers of the user
+    bool update(uint userid = 0, const QString& buffer = QString());
+    bool search(const QString& query, QList<BacklogSearchResult>& results, uint userid = 0, const QString& buffer = QString(), int limit = 50);
+
+    qint64 indexedRows() const { return indexed_rows; }
+
+private:
+
+    bool scopeBuffers(uint userid, const QString& buffer, QVector<qint64>& buffers);
+    bool updateBuffer(qint64 bufferid);
+
+    SqliteNative& db;
+    QString index_file;
+    int batch_size;
+    qint64 indexed_rows;
+};
+
+#endif // BACKLOGSEARCH_H
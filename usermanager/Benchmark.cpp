@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include "Benchmark.h"
+#include "QuasselSchema.h"
+#include "QuasselUser.h"
+
+static const int list_rounds = 20;
+
+static QList<QPair<QString, QString> > benchmarkUsers(QuasselUser& qu, const QString& prefix, int count) {
+
+  QList<QPair<QString, QString> > users;
+  users.reserve(count);
+
+  for( int i = 0; i < count; i++ ) {
+    users.append(qMakePair(QString("%1_%2").arg(prefix).arg(i), qu.hashPasswordSha2_512(QString("secret_%1").arg(i))));
+  }
+
+  return users;
+}
+
+static void printResult(const char* name, qint64 qt_ms, qint64 native_ms) {
+
+  std::cout
+    << "  " << name
+    << ": QtSql " << qt_ms << " ms"
+    << ", native " << native_ms << " ms";
+
+  if( native_ms > 0 )
+    std::cout << " (" << double(qt_ms) / double(native_ms) << "x)";
+
+  std::cout << std::endl;
+}
+
+int runBenchmark(int count) {
+
+  QTemporaryDir dir;
+
+  if( !dir.isValid() ) {
+    std::cerr
+      << "unable to create a temporary directory.\n"
+      << std::endl;
+    return 1;
+  }
+
+  QString database_file = dir.filePath("benchmark.sqlite");
+
+  {
+    SqliteNative schema(database_file);
+
+    if( !schema.open(true) || !createQuasselSchema(schema) )
+      return 1;
+  }
+
+  QuasselUser qu(database_file);
+  QElapsedTimer timer;
+
+  // hashed before timing, both paths share the hashing, only the inserts are compared
+  QList<QPair<QString, QString> > qt_users = benchmarkUsers(qu, "qt", count);
+  QList<QPair<QString, QString> > native_users = benchmarkUsers(qu, "native", count);
+
+  qu.setNativeBackend(false);
+  timer.start();
+  int qt_added = qu.addHashedUsers(qt_users);
+  qint64 qt_add_ms = timer.elapsed();
+
+  qu.setNativeBackend(true);
+  timer.start();
+  int native_added = qu.addHashedUsers(native_users);
+  qint64 native_add_ms = timer.elapsed();
+
+  if( qt_added != count || native_added != count ) {
+    std::cerr
+      << "benchmark setup failed, added " << qt_added << " / " << native_added
+      << " of " << count << " users.\n"
+      << std::endl;
+    return 1;
+  }
+
+  int listed = 0;
+
+  qu.setNativeBackend(false);
+  timer.start();
+  for( int i = 0; i < list_rounds; i++ )
+    listed += qu.getAllAuthUserNames().size();
+  qint64 qt_list_ms = timer.elapsed();
+
+  qu.setNativeBackend(true);
+  timer.start();
+  for( int i = 0; i < list_rounds; i++ )
+    listed -= qu.getAllAuthUserNames().size();
+  qint64 native_list_ms = timer.elapsed();
+
+  if( listed != 0 ) {
+    std::cerr
+      << "QtSql and native path returned different user lists.\n"
+      << std::endl;
+    return 1;
+  }
+
+  std::cout
+    << "benchmark with " << count << " users"
+    << std::endl;
+
+  printResult("batch add", qt_add_ms, native_add_ms);
+  printResult("list (x20)", qt_list_ms, native_list_ms);
+
+  return 0;
+}
@@ -0,0 +1,394 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+#include "ChangeFeed.h"
+#include "QuasselSchema.h"
+
+// a flooded channel brings many senders, the cache starts over instead of growing
+static const int max_cached_senders = 10000;
+
+volatile sig_atomic_t ChangeFeed::sigint = 0;
+
+ChangeFeed::ChangeFeed(SqliteNative& database, const QString& file, int size) :
+  db(database), state_file(file), batch_size(size), last_messageid(0), last_time(0), last_bufferid(0), shipped_rows(0), time_factor(1) {
+}
+
+bool ChangeFeed::attach() {
+
+  if( !db.attach(state_file, "feed") )
+    return false;
+
+  if( !db.exec("CREATE TABLE IF NOT EXISTS feed.feed_state ("
+               "  id INTEGER PRIMARY KEY CHECK (id = 1), last_messageid INTEGER NOT NULL,"
+               "  last_time INTEGER NOT NULL, last_bufferid INTEGER NOT NULL)") )
+    return false;
+
+  // pre-0.13 schemas store seconds
+  time_factor = backlogTimeDivisor(db);
+
+  return loadState();
+}
+
+void ChangeFeed::onSigint(int) {
+  sigint = 1;
+}
+
+bool ChangeFeed::loadState() {
+
+  SqliteStatement* query = db.statement("SELECT last_messageid, last_time, last_bufferid FROM feed.feed_state WHERE id = 1");
+
+  if( query == nullptr )
+    return false;
+
+  if( query->next() ) {
+    last_messageid = query->columnInt64(0);
+    last_time = query->columnInt64(1);
+    last_bufferid = query->columnInt64(2);
+  }
+  query->reset();
+
+  return true;
+}
+
+bool ChangeFeed::saveState(qint64 messageid, qint64 time, qint64 bufferid) {
+
+  // deferred, only the state database is written to
+  if( !db.transaction(false) )
+    return false;
+
+  SqliteStatement* query = db.statement(
+    "INSERT OR REPLACE INTO feed.feed_state (id, last_messageid, last_time, last_bufferid) VALUES (1, ?1, ?2, ?3)");
+
+  if( query == nullptr ) {
+    db.rollback();
+    return false;
+  }
+
+  query->bind(1, messageid);
+  query->bind(2, time);
+  query->bind(3, bufferid);
+
+  if( !query->exec() ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to store the watermark " << messageid
+      << std::endl
+      << "-"
+      << db.lastError().toStdString()
+      << std::endl;
+
+    db.rollback();
+    return false;
+  }
+
+  if( !db.commit() )
+    return false;
+
+  last_messageid = messageid;
+  last_time = time;
+  last_bufferid = bufferid;
+
+  return true;
+}
+
+/**
+ * the core hands out max(messageid) + 1, so reused ids sit right below the
+ * watermark and are newer than the watermark line, walking down from the
+ * watermark to the first older line finds them
+ */
+bool ChangeFeed::checkWatermark() {
+
+  if( last_messageid == 0 )
+    return true;
+
+  SqliteStatement* line = db.statement("SELECT time, bufferid FROM backlog WHERE messageid = ?1");
+
+  if( line == nullptr )
+    return false;
+
+  line->bind(1, last_messageid);
+  bool same = line->next() && line->columnInt64(0) == last_time && line->columnInt64(1) == last_bufferid;
+  line->reset();
+
+  if( same )
+    return true;
+
+  SqliteStatement* walk = db.statement("SELECT messageid, time, bufferid FROM backlog WHERE messageid <= ?1 ORDER BY messageid DESC");
+
+  if( walk == nullptr )
+    return false;
+
+  walk->bind(1, last_messageid);
+
+  qint64 messageid = 0;
+  qint64 time = 0;
+  qint64 bufferid = 0;
+
+  while( walk->next() ) {
+
+    if( walk->columnInt64(1) < last_time ) {
+      messageid = walk->columnInt64(0);
+      time = walk->columnInt64(1);
+      bufferid = walk->columnInt64(2);
+      break;
+    }
+  }
+
+  bool success = ( walk->lastResult() == SQLITE_ROW || walk->lastResult() == SQLITE_DONE );
+  walk->reset();
+
+  if( !success )
+    return false;
+
+  std::cerr
+    << "the watermark line " << last_messageid
+    << " was deleted, continuing after messageid " << messageid
+    << std::endl;
+
+  return saveState(messageid, time, bufferid);
+}
+
+bool ChangeFeed::lookupBuffer(qint64 bufferid, FeedBuffer& buffer) {
+
+  auto cached = buffers.constFind(bufferid);
+
+  if( cached != buffers.constEnd() ) {
+    buffer = cached.value();
+    return true;
+  }
+
+  SqliteStatement* query = db.statement(
+    "SELECT u.username, n.networkname, b.buffername, b.buffertype"
+    "  FROM buffer b"
+    "  LEFT JOIN network n ON n.networkid = b.networkid"
+    "  LEFT JOIN quasseluser u ON u.userid = b.userid"
+    " WHERE b.bufferid = ?1");
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, bufferid);
+
+  // lines of a buffer that is gone by now are shipped without names
+  buffer = FeedBuffer();
+  buffer.buffertype = 0;
+
+  if( query->next() ) {
+    buffer.user = query->columnText(0);
+    buffer.network = query->columnText(1);
+    buffer.buffer = query->columnText(2);
+    buffer.buffertype = query->columnInt(3);
+  }
+
+  bool success = ( query->lastResult() == SQLITE_ROW || query->lastResult() == SQLITE_DONE );
+  query->reset();
+
+  if( success )
+    buffers.insert(bufferid, buffer);
+
+  return success;
+}
+
+bool ChangeFeed::lookupSender(qint64 senderid, QString& sender) {
+
+  auto cached = senders.constFind(senderid);
+
+  if( cached != senders.constEnd() ) {
+    sender = cached.value();
+    return true;
+  }
+
+  SqliteStatement* query = db.statement("SELECT sender FROM sender WHERE senderid = ?1");
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, senderid);
+
+  sender = query->next() ? query->columnText(0) : QString();
+
+  bool success = ( query->lastResult() == SQLITE_ROW || query->lastResult() == SQLITE_DONE );
+  query->reset();
+
+  if( !success )
+    return false;
+
+  if( senders.size() >= max_cached_senders )
+    senders.clear();
+
+  senders.insert(senderid, sender);
+
+  return true;
+}
+
+/**
+ * one batch per statement in messageid order, the watermark follows every
+ * flushed batch
+ */
+bool ChangeFeed::poll(std::ostream& out) {
+
+  // names and ids change between polls (renamed queries, reused ids)
+  buffers.clear();
+  senders.clear();
+
+  // the newest lines were deleted (gc, deleted users), new lines may reuse their ids
+  if( !checkWatermark() )
+    return false;
+
+  forever {
+
+    SqliteStatement* select = db.statement(
+      "SELECT messageid, time, bufferid, type, flags, senderid, senderprefixes, message"
+      "  FROM backlog WHERE messageid > ?1 ORDER BY messageid LIMIT ?2");
+
+    if( select == nullptr )
+      return false;
+
+    select->bind(1, last_messageid);
+    select->bind(2, qint64(batch_size));
+
+    qint64 messageid = last_messageid;
+    qint64 time = last_time;
+    qint64 bufferid = last_bufferid;
+    int rows = 0;
+
+    while( select->next() ) {
+
+      messageid = select->columnInt64(0);
+      time = select->columnInt64(1);
+      bufferid = select->columnInt64(2);
+
+      FeedBuffer buffer;
+      QString sender;
+
+      if( !lookupBuffer(bufferid, buffer) || !lookupSender(select->columnInt64(5), sender) ) {
+        select->reset();
+        return false;
+      }
+
+      QJsonObject json;
+      json.insert("messageid", messageid);
+      json.insert("time", time * time_factor);
+      json.insert("user", buffer.user);
+      json.insert("network", buffer.network);
+      json.insert("buffer", buffer.buffer);
+      json.insert("buffertype", buffer.buffertype);
+      json.insert("type", select->columnInt(3));
+      json.insert("flags", select->columnInt(4));
+      json.insert("sender", sender);
+      json.insert("senderprefixes", select->columnText(6));
+      json.insert("message", select->columnText(7));
+
+      out << QJsonDocument(json).toJson(QJsonDocument::Compact).constData() << "\n";
+
+      rows++;
+    }
+
+    bool success = ( select->lastResult() == SQLITE_DONE );
+
+    if( !success ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to read the backlog above messageid " << last_messageid
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+    }
+
+    select->reset();
+
+    if( rows > 0 ) {
+      out.flush();
+
+      if( !out.good() ) {
+        std::cerr
+          << std::endl
+          << "ERROR: "
+          << "Unable to write the feed, the watermark stays at " << last_messageid
+          << std::endl;
+        return false;
+      }
+
+      shipped_rows += rows;
+
+      // keep the lines that were written even if the next batch fails
+      if( !saveState(messageid, time, bufferid) )
+        return false;
+    }
+
+    if( !success )
+      return false;
+
+    if( rows < batch_size )
+      break;
+  }
+
+  return true;
+}
+
+/**
+ * data_version only changes with commits of other connections, an idle
+ * core costs one pragma per interval
+ */
+bool ChangeFeed::follow(std::ostream& out, int interval) {
+
+  sigint = 0;
+
+  void (*previous_handler)(int) = signal(SIGINT, &ChangeFeed::onSigint);
+  void (*previous_term_handler)(int) = signal(SIGTERM, &ChangeFeed::onSigint);
+
+  qint64 data_version = db.pragma("main.data_version");
+  bool success = poll(out);
+
+  while( success && sigint == 0 ) {
+
+    QElapsedTimer slept;
+    slept.start();
+
+    while( sigint == 0 && slept.elapsed() < interval )
+      QThread::msleep(qMin(Q_INT64_C(50), interval - slept.elapsed()));
+
+    if( sigint != 0 )
+      break;
+
+    qint64 version = db.pragma("main.data_version");
+
+    if( version == data_version )
+      continue;
+
+    data_version = version;
+    success = poll(out);
+  }
+
+  signal(SIGINT, previous_handler);
+  signal(SIGTERM, previous_term_handler);
+
+  return success;
+}
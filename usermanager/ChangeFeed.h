@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CHANGEFEED_H
+#define CHANGEFEED_H
+
+#include <csignal>
+#include <ostream>
+
+#include <QHash>
+#include <QString>
+
+#include "SqliteNative.h"
+
+struct FeedBuffer {
+    QString user;
+    QString network;
+    QString buffer;
+    int buffertype;
+};
+
+/*
+ * Streams the backlog lines above a persisted messageid watermark as JSONL.
+ *
+ * Every batch is written and flushed before its last messageid is stored
+ * in the state file, so a crash ships a batch twice but never skips one.
+ * The time and buffer of the watermark line are stored with it: once that
+ * line is gone or another one has its id, the newest lines were deleted
+ * and the core reused their ids, the feed then steps back to the last line
+ * that is older than the watermark.
+ * Buffer and sender names come from small caches that are filled by point
+ * lookups, the backlog itself is only read above the watermark. The caches
+ * only live for one poll(): the core renames query buffers and reuses the
+ * ids of deleted buffers and senders.
+ */
+class ChangeFeed {
+
+public:
+    ChangeFeed(SqliteNative& db, const QString& state_file, int batch_size = 5000);
+
+    bool attach();
+
+    // ships everything above the watermark
+    bool poll(std::ostream& out);
+    // polls again every interval msecs once data_version reports a commit, until SIGINT
+    bool follow(std::ostream& out, int interval);
+
+    qint64 watermark() const { return last_messageid; }
+    qint64 shippedRows() const { return shipped_rows; }
+
+private:
+
+    bool loadState();
+    bool saveState(qint64 messageid, qint64 time, qint64 bufferid);
+    bool checkWatermark();
+    bool lookupBuffer(qint64 bufferid, FeedBuffer& buffer);
+    bool lookupSender(qint64 senderid, QString& sender);
+
+    static void onSigint(int);
+    static volatile sig_atomic_t sigint;
+
+    SqliteNative& db;
+    QString state_file;
+    int batch_size;
+
+    qint64 last_messageid;
+    qint64 last_time;
+    qint64 last_bufferid;
+    qint64 shipped_rows;
+    qint64 time_factor;
+
+    QHash<qint64, FeedBuffer> buffers;
+    QHash<qint64, QString> senders;
+};
+
+#endif // CHANGEFEED_H
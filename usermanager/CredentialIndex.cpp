@@ -0,0 +1,197 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <QDebug>
+
+#include "CredentialIndex.h"
+
+// QuasselUser::HashVersion
+static const int hash_sha2_512 = 1;
+
+CredentialIndex::CredentialIndex(const QString& database_file) :
+  db(database_file), scan_version(-1), sha2_512(QCryptographicHash::Sha512) {
+}
+
+bool CredentialIndex::load() {
+
+  if( !db.open() )
+    return false;
+
+  if( version_query.isNull() ) {
+    version_query.reset(new SqliteStatement(db.handle(), "PRAGMA data_version"));
+    user_query.reset(new SqliteStatement(db.handle(),
+      "SELECT userid, password, hashversion, authenticator FROM quasseluser WHERE username = ?1"));
+
+    if( !version_query->isValid() || !user_query->isValid() )
+      return false;
+  }
+
+  // version and rows from the same snapshot
+  if( !db.transaction(false) )
+    return false;
+
+  SqliteStatement* scan = db.statement("SELECT userid, username, password, hashversion, authenticator FROM quasseluser");
+
+  if( scan == nullptr ) {
+    db.rollback();
+    return false;
+  }
+
+  qint64 version = dataVersion();
+
+  entries.clear();
+
+  while( scan->next() ) {
+
+    CredentialEntry entry;
+
+    entry.userid = scan->columnInt64(0);
+    entry.hashversion = scan->columnInt(3);
+    entry.authenticator = scan->columnText(4);
+    entry.version = version;
+
+    if( !parse(scan->columnBlob(2), entry) && entry.hashversion == hash_sha2_512 )
+      qWarning() << "Password hash and salt were not in the correct format for" << scan->columnText(1);
+
+    entries.insert(scan->columnText(1), entry);
+  }
+
+  bool success = ( scan->lastResult() == SQLITE_DONE );
+  scan->reset();
+
+  db.commit();
+
+  scan_version = success ? version : -1;
+
+  return success;
+}
+
+qint64 CredentialIndex::dataVersion() {
+
+  qint64 version = version_query->next() ? version_query->columnInt64(0) : -1;
+  version_query->reset();
+
+  return version;
+}
+
+const CredentialEntry* CredentialIndex::find(const QString& username) {
+
+  qint64 version = dataVersion();
+
+  if( version < 0 )
+    return nullptr;
+
+  QHash<QString, CredentialEntry>::const_iterator entry = entries.constFind(username);
+
+  if( entry != entries.constEnd() && entry.value().version == version )
+    return &entry.value();
+
+  // nothing changed since the full scan, so the user does not exist
+  if( entry == entries.constEnd() && version == scan_version )
+    return nullptr;
+
+  if( !reload(username, version) )
+    return nullptr;
+
+  entry = entries.constFind(username);
+
+  return ( entry != entries.constEnd() ) ? &entry.value() : nullptr;
+}
+
+uint CredentialIndex::validate(const QString& username, const QString& password) {
+
+  const CredentialEntry* entry = find(username);
+
+  return ( entry != nullptr && check(*entry, password) ) ? entry->userid : 0;
+}
+
+bool CredentialIndex::reload(const QString& username, qint64 version) {
+
+  user_query->bind(1, username);
+
+  if( !user_query->next() ) {
+    bool done = ( user_query->lastResult() == SQLITE_DONE );
+    user_query->reset();
+
+    if( done )
+      entries.remove(username);
+
+    return done;
+  }
+
+  CredentialEntry& entry = entries[username];
+
+  entry.userid = user_query->columnInt64(0);
+  entry.hashversion = user_query->columnInt(2);
+  entry.authenticator = user_query->columnText(3);
+  entry.version = version;
+
+  if( !parse(user_query->columnBlob(1), entry) && entry.hashversion == hash_sha2_512 )
+    qWarning() << "Password hash and salt were not in the correct format for" << username;
+
+  user_query->reset();
+
+  return true;
+}
+
+/**
+ * sha2_512 is stored as hex digest ':' hex salt and the salt is hashed in its
+ * hex form, sha1 and unknown formats never validate (as in validateUser)
+ */
+bool CredentialIndex::parse(const QByteArray& stored, CredentialEntry& entry) {
+
+  entry.salt.clear();
+  entry.digest.clear();
+
+  int colon = stored.indexOf(':');
+
+  if( entry.hashversion != hash_sha2_512 || colon <= 0 )
+    return false;
+
+  entry.digest = QByteArray::fromHex(stored.left(colon));
+  entry.salt = stored.mid(colon + 1);
+
+  return entry.digest.size() == 64;
+}
+
+bool CredentialIndex::check(const CredentialEntry& entry, const QString& password) {
+
+  if( entry.digest.isEmpty() )
+    return false;
+
+  QCryptographicHash& hash = sha2_512;
+
+  hash.reset();
+  hash.addData(password.toUtf8());
+  hash.addData(entry.salt);
+
+  QByteArray digest = hash.result();
+
+  if( digest.size() != entry.digest.size() )
+    return false;
+
+  // compare every byte, the time must not tell how much of the digest matched
+  unsigned char difference = 0;
+
+  for( int i = 0; i < digest.size(); i++ )
+    difference |= digest.at(i) ^ entry.digest.at(i);
+
+  return difference == 0;
+}
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef CREDENTIALINDEX_H
+#define CREDENTIALINDEX_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QScopedPointer>
+#include <QString>
+
+#include "SqliteNative.h"
+
+struct CredentialEntry {
+    uint userid;
+    int hashversion;
+    // the salt as it is appended to the password, the digest as raw bytes
+    QByteArray salt;
+    QByteArray digest;
+    QString authenticator;
+    // data_version the entry was read at
+    qint64 version;
+};
+
+/*
+ * Password hashes of all users in memory, parsed once.
+ *
+ * The index keeps its own connection, so every commit of the core, another
+ * tool or a different connection of this process shows up in its
+ * data_version. Entries read at an older version are reloaded one by one
+ * when they are asked for.
+ *
+ * data_version covers the whole database: on a core that is writing backlog
+ * nearly every login finds a new version and still costs a point lookup,
+ * only the hash parsing is saved. Logins are answered from memory alone
+ * while the database is idle.
+ *
+ * Like QuasselUser::validateUser only sha2_512 hashes validate, legacy
+ * sha1 users are rejected.
+ */
+class CredentialIndex {
+
+public:
+    CredentialIndex(const QString& database_file);
+
+    // one scan over quasseluser
+    bool load();
+
+    // nullptr for unknown users
+    const CredentialEntry* find(const QString& username);
+    uint validate(const QString& username, const QString& password);
+
+    int size() const { return entries.size(); }
+
+private:
+
+    qint64 dataVersion();
+    bool reload(const QString& username, qint64 version);
+    bool check(const CredentialEntry& entry, const QString& password);
+
+    static bool parse(const QByteArray& stored, CredentialEntry& entry);
+
+    SqliteNative db;
+    QScopedPointer<SqliteStatement> version_query;
+    QScopedPointer<SqliteStatement> user_query;
+
+    QHash<QString, CredentialEntry> entries;
+    qint64 scan_version;
+
+    QCryptographicHash sha2_512;
+};
+
+#endif // CREDENTIALINDEX_H
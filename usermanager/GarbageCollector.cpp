@@ -0,0 +1,390 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include "GarbageCollector.h"
+
+// tables with per-user rows, in dependency order, and the condition that makes a row dead
+static const char* const user_tables[][2] = {
+  { "buffer"       , "NOT EXISTS (SELECT 1 FROM quasseluser u WHERE u.userid = t.userid)"
+                     " AND NOT EXISTS (SELECT 1 FROM backlog b WHERE b.bufferid = t.bufferid)" },
+  { "ircserver"    , "NOT EXISTS (SELECT 1 FROM quasseluser u WHERE u.userid = t.userid)" },
+  { "network"      , "NOT EXISTS (SELECT 1 FROM quasseluser u WHERE u.userid = t.userid)" },
+  { "identity"     , "NOT EXISTS (SELECT 1 FROM quasseluser u WHERE u.userid = t.userid)" },
+  { "identity_nick", "NOT EXISTS (SELECT 1 FROM identity i WHERE i.identityid = t.identityid)" },
+  { "user_setting" , "NOT EXISTS (SELECT 1 FROM quasseluser u WHERE u.userid = t.userid)" },
+  { "coresession"  , "NOT EXISTS (SELECT 1 FROM quasseluser u WHERE u.userid = t.userid)" },
+  { nullptr, nullptr }
+};
+
+GarbageCollector::GarbageCollector(SqliteNative& database, int size) :
+  db(database), batch_size(size), live_sender_watermark(0), live_sender_time(0), freed_pages(0), page_size(0) {
+}
+
+bool GarbageCollector::run() {
+
+  deleted_rows.clear();
+  freed_pages = 0;
+  page_size = db.pragma("page_size");
+
+  qint64 page_count = db.pragma("page_count");
+  qint64 freelist_count = db.pragma("freelist_count");
+
+  if( !collectBacklog() )
+    return false;
+
+  for( int i = 0; user_tables[i][0] != nullptr; i++ ) {
+
+    if( !db.hasTable(user_tables[i][0]) )
+      continue;
+
+    if( !collectTable(user_tables[i][0], user_tables[i][1]) )
+      return false;
+  }
+
+  if( !collectSenders() )
+    return false;
+
+  // with auto_vacuum = INCREMENTAL the free pages can be handed back right away
+  if( db.pragma("auto_vacuum") == 2 )
+    db.exec("PRAGMA incremental_vacuum");
+
+  freed_pages = ( page_count - db.pragma("page_count") ) + ( db.pragma("freelist_count") - freelist_count );
+
+  return true;
+}
+
+/**
+ * walk the distinct bufferids of the backlog through backlog_bufferid_idx
+ * and drop the lines of every buffer that (or whose user) no longer exists
+ */
+bool GarbageCollector::collectBacklog() {
+
+  qint64 deleted = 0;
+  qint64 bufferid = 0;
+
+  forever {
+
+    SqliteStatement* next_buffer = db.statement("SELECT min(bufferid) FROM backlog WHERE bufferid > ?1");
+
+    if( next_buffer == nullptr )
+      return false;
+
+    next_buffer->bind(1, bufferid);
+
+    bool found = ( next_buffer->next() && !next_buffer->columnIsNull(0) );
+
+    if( found )
+      bufferid = next_buffer->columnInt64(0);
+
+    next_buffer->reset();
+
+    if( !found )
+      break;
+
+    SqliteStatement* alive = db.statement("SELECT 1 FROM buffer b JOIN quasseluser u ON u.userid = b.userid WHERE b.bufferid = ?1");
+
+    if( alive == nullptr )
+      return false;
+
+    alive->bind(1, bufferid);
+    bool orphan = !alive->next();
+    alive->reset();
+
+    if( orphan ) {
+
+      QByteArray select_sql = "SELECT messageid FROM backlog WHERE bufferid = ?3 AND messageid > ?1 ORDER BY messageid LIMIT ?2";
+      QByteArray delete_sql = "DELETE FROM backlog WHERE messageid = ?1";
+
+      if( !collectRowIds(select_sql, delete_sql, deleted, bufferid) )
+        return false;
+    }
+  }
+
+  deleted_rows.append(qMakePair(QString("backlog"), deleted));
+
+  return true;
+}
+
+bool GarbageCollector::collectTable(const char* table, const char* condition) {
+
+  qint64 deleted = 0;
+
+  QByteArray select_sql = QByteArray("SELECT rowid FROM ") + table + " t WHERE rowid > ?1 AND " + condition + " ORDER BY rowid LIMIT ?2";
+  QByteArray delete_sql = QByteArray("DELETE FROM ") + table + " WHERE rowid = ?1";
+
+  if( !collectRowIds(select_sql, delete_sql, deleted) )
+    return false;
+
+  deleted_rows.append(qMakePair(QString(table), deleted));
+
+  return true;
+}
+
+/**
+ * the core has no index on backlog.senderid, so the referenced senders are
+ * collected once into an indexed temp table and every batch only adds the
+ * senders of lines written since then
+ */
+bool GarbageCollector::collectSenders() {
+
+  qint64 deleted = 0;
+  bool has_sender_index = false;
+
+  if( !hasSenderIndex(has_sender_index) )
+    return false;
+
+  // the delete checks again, a line may have been written since the select
+  QByteArray select_sql = "SELECT senderid FROM sender t WHERE senderid > ?1 AND ";
+  QByteArray delete_sql = "DELETE FROM sender WHERE senderid = ?1 AND ";
+
+  if( has_sender_index ) {
+
+    select_sql += "NOT EXISTS (SELECT 1 FROM backlog b WHERE b.senderid = t.senderid) ORDER BY senderid LIMIT ?2";
+    delete_sql += "NOT EXISTS (SELECT 1 FROM backlog b WHERE b.senderid = ?1)";
+
+    if( !collectRowIds(select_sql, delete_sql, deleted) )
+      return false;
+
+  } else {
+
+    select_sql += "NOT EXISTS (SELECT 1 FROM temp.gc_live_sender l WHERE l.senderid = t.senderid) ORDER BY senderid LIMIT ?2";
+    delete_sql += "NOT EXISTS (SELECT 1 FROM temp.gc_live_sender l WHERE l.senderid = ?1)";
+
+    live_sender_watermark = 0;
+    live_sender_time = 0;
+
+    if( !db.exec("DROP TABLE IF EXISTS temp.gc_live_sender") ||
+        !db.exec("CREATE TEMP TABLE gc_live_sender (senderid INTEGER PRIMARY KEY)") )
+      return false;
+
+    // the initial scan runs outside of a write transaction
+    if( !refreshLiveSenders() )
+      return false;
+
+    bool success = collectRowIds(select_sql, delete_sql, deleted, 0, &GarbageCollector::refreshLiveSenders);
+
+    db.exec("DROP TABLE IF EXISTS temp.gc_live_sender");
+
+    if( !success )
+      return false;
+  }
+
+  deleted_rows.append(qMakePair(QString("sender"), deleted));
+
+  return true;
+}
+
+/**
+ * PRAGMA statements instead of pragma_index_list(), the table-valued
+ * pragma functions need sqlite 3.16
+ */
+bool GarbageCollector::hasSenderIndex(bool& found) {
+
+  found = false;
+
+  SqliteStatement* list = db.statement("PRAGMA main.index_list(backlog)");
+
+  if( list == nullptr )
+    return false;
+
+  QList<QString> indexes;
+
+  while( list->next() )
+    indexes.append(list->columnText(1));
+
+  list->reset();
+
+  for( const QString& index : indexes ) {
+
+    QByteArray sql = QByteArray("PRAGMA main.index_info(\"") + index.toUtf8().replace('"', "\"\"") + "\")";
+    SqliteStatement* info = db.statement(sql.constData());
+
+    if( info == nullptr )
+      return false;
+
+    // the first column of the index
+    found = info->next() && info->columnText(2) == "senderid";
+    info->reset();
+
+    if( found )
+      break;
+  }
+
+  return true;
+}
+
+/**
+ * runs inside the write transaction of every batch, so the core can not
+ * add a line between this and the delete
+ *
+ * the core hands out max(messageid) + 1, once the newest lines were deleted
+ * new lines reuse ids below the watermark: the watermark line is checked
+ * and the watermark goes back to the last older line when it changed
+ */
+bool GarbageCollector::refreshLiveSenders() {
+
+  SqliteStatement* max_id = db.statement("SELECT coalesce(max(messageid), 0) FROM backlog");
+
+  if( max_id == nullptr || !max_id->next() )
+    return false;
+
+  qint64 watermark = max_id->columnInt64(0);
+  max_id->reset();
+
+  if( live_sender_watermark > 0 ) {
+
+    SqliteStatement* line = db.statement("SELECT time FROM backlog WHERE messageid = ?1");
+    SqliteStatement* back = db.statement("SELECT messageid FROM backlog WHERE messageid <= ?1 AND time < ?2 ORDER BY messageid DESC LIMIT 1");
+
+    if( line == nullptr || back == nullptr )
+      return false;
+
+    line->bind(1, live_sender_watermark);
+    bool same = line->next() && line->columnInt64(0) == live_sender_time;
+    line->reset();
+
+    if( !same ) {
+      back->bind(1, live_sender_watermark);
+      back->bind(2, live_sender_time);
+      live_sender_watermark = back->next() ? back->columnInt64(0) : 0;
+      back->reset();
+    }
+  }
+
+  if( watermark == live_sender_watermark )
+    return true;
+
+  SqliteStatement* insert = db.statement(
+    "INSERT OR IGNORE INTO temp.gc_live_sender SELECT senderid FROM backlog WHERE messageid > ?1 AND messageid <= ?2");
+
+  if( insert == nullptr )
+    return false;
+
+  insert->bind(1, live_sender_watermark);
+  insert->bind(2, watermark);
+
+  if( !insert->exec() )
+    return false;
+
+  SqliteStatement* time = db.statement("SELECT time FROM backlog WHERE messageid = ?1");
+
+  if( time == nullptr )
+    return false;
+
+  time->bind(1, watermark);
+  live_sender_time = time->next() ? time->columnInt64(0) : 0;
+  time->reset();
+
+  live_sender_watermark = watermark;
+
+  return true;
+}
+
+/**
+ * select_sql returns up to ?2 ascending row ids greater than ?1 (and may use
+ * ?3 for key), delete_sql removes the row with id ?1
+ */
+bool GarbageCollector::collectRowIds(const QByteArray& select_sql, const QByteArray& delete_sql, qint64& deleted, qint64 key, bool (GarbageCollector::*prepare)()) {
+
+  QVector<qint64> ids;
+  ids.reserve(batch_size);
+
+  qint64 cursor = 0;
+
+  forever {
+
+    if( !db.transaction() )
+      return false;
+
+    if( prepare != nullptr && !(this->*prepare)() ) {
+      db.rollback();
+      return false;
+    }
+
+    SqliteStatement* select = db.statement(select_sql.constData());
+    SqliteStatement* remove = db.statement(delete_sql.constData());
+
+    if( select == nullptr || remove == nullptr ) {
+      db.rollback();
+      return false;
+    }
+
+    select->bind(1, cursor);
+    select->bind(2, qint64(batch_size));
+
+    if( select->parameterCount() >= 3 )
+      select->bind(3, key);
+
+    ids.clear();
+
+    while( select->next() )
+      ids.append(select->columnInt64(0));
+
+    bool selected = ( select->lastResult() == SQLITE_DONE );
+    select->reset();
+
+    if( !selected ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << select_sql.constData()
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+
+    for( qint64 id : ids ) {
+
+      remove->bind(1, id);
+
+      if( !remove->exec() ) {
+        std::cerr
+          << std::endl
+          << "ERROR: "
+          << delete_sql.constData()
+          << std::endl
+          << "-"
+          << db.lastError().toStdString()
+          << std::endl;
+
+        db.rollback();
+        return false;
+      }
+
+      deleted += db.numRowsAffected();
+    }
+
+    if( !db.commit() )
+      return false;
+
+    if( ids.size() < batch_size )
+      break;
+
+    cursor = ids.last();
+  }
+
+  return true;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef GARBAGECOLLECTOR_H
+#define GARBAGECOLLECTOR_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include "SqliteNative.h"
+
+/*
+ * Removes rows the core no longer references: backlog and buffers of
+ * deleted users or buffers, network, identity and settings rows of deleted
+ * users and senders without any backlog line.
+ *
+ * Every batch runs in its own write transaction, so the running core only
+ * waits for a single batch and never for the whole run.
+ */
+class GarbageCollector {
+
+public:
+    GarbageCollector(SqliteNative& db, int batch_size = 5000);
+
+    bool run();
+
+    // deleted rows per table, in the order they were collected
+    QList<QPair<QString, qint64> > deletedRows() const { return deleted_rows; }
+
+    qint64 freedPages() const { return freed_pages; }
+    qint64 pageSize() const { return page_size; }
+
+private:
+
+    bool collectBacklog();
+    bool collectTable(const char* table, const char* condition);
+    bool collectSenders();
+
+    bool collectRowIds(const QByteArray& select_sql, const QByteArray& delete_sql, qint64& deleted,
+                       qint64 key = 0, bool (GarbageCollector::*prepare)() = nullptr);
+    bool refreshLiveSenders();
+    bool hasSenderIndex(bool& found);
+
+    SqliteNative& db;
+    int batch_size;
+
+    qint64 live_sender_watermark;
+    qint64 live_sender_time;
+    QList<QPair<QString, qint64> > deleted_rows;
+    qint64 freed_pages;
+    qint64 page_size;
+};
+
+#endif // GARBAGECOLLECTOR_H
@@ -0,0 +1,458 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStringList>
+#include <QThread>
+
+#include "GrowthSampler.h"
+
+// buffers listed per sample
+static const int top_buffers = 5;
+// the first sample after a long pause would count too many lines per buffer
+static const qint64 max_counted_lines = 1000000;
+
+volatile sig_atomic_t GrowthSampler::sigint = 0;
+
+GrowthSampler::GrowthSampler(SqliteNative& database, const QString& file, int size) :
+  db(database), sample_file(file), ring_size(size), detail(false),
+  prometheus(file.endsWith(".prom")), has_previous(false), previous(), current() {
+}
+
+void GrowthSampler::onSigint(int) {
+  sigint = 1;
+}
+
+/**
+ * dbstat is a compile time option of sqlite
+ */
+bool GrowthSampler::hasDbstat() {
+
+  if( !db.isOpen() && !db.open() )
+    return false;
+
+  sqlite3_stmt* stmt = nullptr;
+  bool available = ( sqlite3_prepare_v2(db.handle(), "SELECT name FROM dbstat LIMIT 0", -1, &stmt, nullptr) == SQLITE_OK );
+  sqlite3_finalize(stmt);
+
+  return available;
+}
+
+/**
+ * the previous sample is read back from the sample file, so deltas also
+ * work across runs from cron
+ */
+bool GrowthSampler::loadPrevious() {
+
+  QFile file(sample_file);
+
+  if( !file.exists() )
+    return true;
+
+  if( !file.open(QIODevice::ReadOnly) ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to read " << sample_file.toStdString()
+      << std::endl
+      << "-"
+      << file.errorString().toStdString()
+      << std::endl;
+    return false;
+  }
+
+  QList<QByteArray> lines = file.readAll().split('\n');
+
+  if( prometheus ) {
+
+    bool found = false;
+
+    for( const QByteArray& line : lines ) {
+
+      QByteArray value = line.mid(line.lastIndexOf(' ') + 1);
+
+      if( line.startsWith("quassel_db_sample_timestamp_seconds ") ) {
+        previous.time = value.toLongLong() * 1000;
+        found = true;
+      } else
+      if( line.startsWith("quassel_db_page_count ") ) {
+        previous.page_count = value.toLongLong();
+      } else
+      if( line.startsWith("quassel_db_max_id{table=\"backlog\"} ") ) {
+        previous.max_messageid = value.toLongLong();
+      }
+    }
+
+    has_previous = found;
+    return true;
+  }
+
+  for( int i = lines.size() - 1; i >= 0; i-- ) {
+
+    if( lines.at(i).trimmed().isEmpty() )
+      continue;
+
+    QJsonObject json = QJsonDocument::fromJson(lines.at(i)).object();
+
+    if( json.isEmpty() )
+      break;
+
+    previous.time = qint64(json.value("time").toDouble());
+    previous.page_count = qint64(json.value("page_count").toDouble());
+    previous.max_messageid = qint64(json.value("max_messageid").toDouble());
+    has_previous = true;
+    break;
+  }
+
+  return true;
+}
+
+bool GrowthSampler::collect(GrowthSample& sample) {
+
+  sample = GrowthSample();
+  sample.time = QDateTime::currentMSecsSinceEpoch();
+  sample.page_size = db.pragma("page_size");
+  sample.page_count = db.pragma("page_count");
+  sample.freelist_count = db.pragma("freelist_count");
+
+  if( sample.page_size < 0 || sample.page_count < 0 || sample.freelist_count < 0 )
+    return false;
+
+  QFileInfo wal(db.fileName() + "-wal");
+  sample.wal_bytes = wal.exists() ? wal.size() : 0;
+
+  // the rowid tables keep their highest id at the end of the b-tree
+  SqliteStatement* ids = db.statement(
+    "SELECT (SELECT coalesce(max(messageid), 0) FROM backlog),"
+    "       (SELECT coalesce(max(senderid), 0) FROM sender),"
+    "       (SELECT coalesce(max(bufferid), 0) FROM buffer)");
+
+  if( ids == nullptr || !ids->next() ) {
+    if( ids != nullptr )
+      ids->reset();
+    return false;
+  }
+
+  sample.max_messageid = ids->columnInt64(0);
+  sample.max_senderid = ids->columnInt64(1);
+  sample.max_bufferid = ids->columnInt64(2);
+  ids->reset();
+
+  if( has_previous ) {
+    sample.elapsed = sample.time - previous.time;
+    sample.new_lines = sample.max_messageid - previous.max_messageid;
+    sample.new_pages = sample.page_count - previous.page_count;
+  }
+
+  // the leading number of sqlite_stat1.stat is the row count ANALYZE saw
+  if( db.hasTable("sqlite_stat1") ) {
+
+    SqliteStatement* rows = db.statement("SELECT tbl, max(CAST(stat AS INTEGER)) FROM sqlite_stat1 GROUP BY tbl ORDER BY tbl");
+
+    if( rows == nullptr )
+      return false;
+
+    while( rows->next() )
+      sample.estimated_rows.append(qMakePair(rows->columnText(0), rows->columnInt64(1)));
+
+    rows->reset();
+  }
+
+  if( detail && hasDbstat() ) {
+
+    SqliteStatement* pages = db.statement("SELECT name, count(*) FROM dbstat GROUP BY name ORDER BY 2 DESC");
+
+    if( pages == nullptr )
+      return false;
+
+    while( pages->next() )
+      sample.object_pages.append(qMakePair(pages->columnText(0), pages->columnInt64(1)));
+
+    pages->reset();
+  }
+
+  if( sample.new_lines > 0 && sample.new_lines <= max_counted_lines ) {
+
+    SqliteStatement* buffers = db.statement(
+      "SELECT coalesce(u.username, ''), coalesce(b.buffername, ''), g.lines"
+      "  FROM (SELECT bufferid, count(*) AS lines FROM backlog WHERE messageid > ?1"
+      "         GROUP BY bufferid ORDER BY lines DESC LIMIT ?2) g"
+      "  LEFT JOIN buffer b ON b.bufferid = g.bufferid"
+      "  LEFT JOIN quasseluser u ON u.userid = b.userid"
+      " ORDER BY g.lines DESC");
+
+    if( buffers == nullptr )
+      return false;
+
+    buffers->bind(1, previous.max_messageid);
+    buffers->bind(2, top_buffers);
+
+    while( buffers->next() ) {
+      BufferGrowth growth;
+      growth.user = buffers->columnText(0);
+      growth.buffer = buffers->columnText(1);
+      growth.lines = buffers->columnInt64(2);
+      sample.buffers.append(growth);
+    }
+
+    buffers->reset();
+  }
+
+  return true;
+}
+
+/**
+ * keeps the newest ring_size samples, the file is replaced atomically
+ */
+bool GrowthSampler::writeRing(const GrowthSample& sample) {
+
+  QList<QByteArray> lines;
+  QFile old_file(sample_file);
+
+  if( old_file.exists() && old_file.open(QIODevice::ReadOnly) ) {
+
+    for( const QByteArray& line : old_file.readAll().split('\n') ) {
+      if( !line.trimmed().isEmpty() )
+        lines.append(line);
+    }
+
+    old_file.close();
+  }
+
+  QJsonObject json;
+  json.insert("time", sample.time);
+  json.insert("page_size", sample.page_size);
+  json.insert("page_count", sample.page_count);
+  json.insert("freelist_count", sample.freelist_count);
+  json.insert("wal_bytes", sample.wal_bytes);
+  json.insert("max_messageid", sample.max_messageid);
+  json.insert("max_senderid", sample.max_senderid);
+  json.insert("max_bufferid", sample.max_bufferid);
+  json.insert("elapsed", sample.elapsed);
+  json.insert("new_lines", sample.new_lines);
+  json.insert("new_pages", sample.new_pages);
+
+  if( !sample.estimated_rows.isEmpty() ) {
+    QJsonObject rows;
+
+    for( auto e : sample.estimated_rows )
+      rows.insert(e.first, e.second);
+
+    json.insert("estimated_rows", rows);
+  }
+
+  if( !sample.object_pages.isEmpty() ) {
+    QJsonObject pages;
+
+    for( auto e : sample.object_pages )
+      pages.insert(e.first, e.second);
+
+    json.insert("pages", pages);
+  }
+
+  if( !sample.buffers.isEmpty() ) {
+    QJsonArray buffers;
+
+    for( const BufferGrowth& growth : sample.buffers ) {
+      QJsonObject buffer;
+      buffer.insert("user", growth.user);
+      buffer.insert("buffer", growth.buffer);
+      buffer.insert("lines", growth.lines);
+      buffers.append(buffer);
+    }
+
+    json.insert("buffers", buffers);
+  }
+
+  lines.append(QJsonDocument(json).toJson(QJsonDocument::Compact));
+
+  while( lines.size() > ring_size )
+    lines.removeFirst();
+
+  QSaveFile file(sample_file);
+
+  if( !file.open(QIODevice::WriteOnly) ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to write " << sample_file.toStdString()
+      << std::endl
+      << "-"
+      << file.errorString().toStdString()
+      << std::endl;
+    return false;
+  }
+
+  for( const QByteArray& line : lines ) {
+    file.write(line);
+    file.write("\n");
+  }
+
+  return file.commit();
+}
+
+static QByteArray label(const QString& value) {
+
+  QByteArray escaped = value.toUtf8();
+  escaped.replace('\\', "\\\\");
+  escaped.replace('"', "\\\"");
+  escaped.replace('\n', "\\n");
+
+  return escaped;
+}
+
+/**
+ * the node exporter textfile collector expects the file to be replaced in
+ * one step, QSaveFile renames it into place
+ */
+bool GrowthSampler::writePrometheus(const GrowthSample& sample) {
+
+  QByteArray out;
+
+  auto metric = [&out](const char* name, const char* help) {
+    out += QByteArray("# HELP ") + name + " " + help + "\n";
+    out += QByteArray("# TYPE ") + name + " gauge\n";
+  };
+
+  metric("quassel_db_sample_timestamp_seconds", "Time of the sample.");
+  out += QByteArray("quassel_db_sample_timestamp_seconds ") + QByteArray::number(sample.time / 1000) + "\n";
+
+  metric("quassel_db_page_size_bytes", "Page size of the database.");
+  out += QByteArray("quassel_db_page_size_bytes ") + QByteArray::number(sample.page_size) + "\n";
+
+  metric("quassel_db_page_count", "Pages of the database file.");
+  out += QByteArray("quassel_db_page_count ") + QByteArray::number(sample.page_count) + "\n";
+
+  metric("quassel_db_freelist_count", "Unused pages of the database file.");
+  out += QByteArray("quassel_db_freelist_count ") + QByteArray::number(sample.freelist_count) + "\n";
+
+  metric("quassel_db_wal_bytes", "Size of the write-ahead log.");
+  out += QByteArray("quassel_db_wal_bytes ") + QByteArray::number(sample.wal_bytes) + "\n";
+
+  metric("quassel_db_max_id", "Highest id of a rowid table.");
+  out += QByteArray("quassel_db_max_id{table=\"backlog\"} ") + QByteArray::number(sample.max_messageid) + "\n";
+  out += QByteArray("quassel_db_max_id{table=\"sender\"} ") + QByteArray::number(sample.max_senderid) + "\n";
+  out += QByteArray("quassel_db_max_id{table=\"buffer\"} ") + QByteArray::number(sample.max_bufferid) + "\n";
+
+  if( !sample.estimated_rows.isEmpty() ) {
+    metric("quassel_db_estimated_rows", "Row count of a table at the last ANALYZE.");
+
+    for( auto e : sample.estimated_rows )
+      out += QByteArray("quassel_db_estimated_rows{table=\"") + label(e.first) + "\"} " + QByteArray::number(e.second) + "\n";
+  }
+
+  if( !sample.object_pages.isEmpty() ) {
+    metric("quassel_db_object_pages", "Pages of a table or index.");
+
+    for( auto e : sample.object_pages )
+      out += QByteArray("quassel_db_object_pages{name=\"") + label(e.first) + "\"} " + QByteArray::number(e.second) + "\n";
+  }
+
+  if( !sample.buffers.isEmpty() ) {
+    metric("quassel_db_buffer_new_lines", "New backlog lines of the fastest growing buffers since the previous sample.");
+
+    for( const BufferGrowth& growth : sample.buffers ) {
+      out += QByteArray("quassel_db_buffer_new_lines{user=\"") + label(growth.user) + "\",buffer=\"" + label(growth.buffer) + "\"} "
+           + QByteArray::number(growth.lines) + "\n";
+    }
+  }
+
+  QSaveFile file(sample_file);
+
+  if( !file.open(QIODevice::WriteOnly) ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to write " << sample_file.toStdString()
+      << std::endl
+      << "-"
+      << file.errorString().toStdString()
+      << std::endl;
+    return false;
+  }
+
+  file.write(out);
+
+  return file.commit();
+}
+
+bool GrowthSampler::sample() {
+
+  if( !has_previous && !loadPrevious() )
+    return false;
+
+  if( !collect(current) ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to sample " << db.fileName().toStdString()
+      << std::endl
+      << "-"
+      << db.lastError().toStdString()
+      << std::endl;
+    return false;
+  }
+
+  if( !( prometheus ? writePrometheus(current) : writeRing(current) ) )
+    return false;
+
+  previous = current;
+  has_previous = true;
+
+  return true;
+}
+
+bool GrowthSampler::run(int interval) {
+
+  sigint = 0;
+
+  void (*previous_handler)(int) = signal(SIGINT, &GrowthSampler::onSigint);
+  void (*previous_term_handler)(int) = signal(SIGTERM, &GrowthSampler::onSigint);
+
+  bool success = sample();
+
+  while( success && sigint == 0 ) {
+
+    QElapsedTimer slept;
+    slept.start();
+
+    while( sigint == 0 && slept.elapsed() < interval )
+      QThread::msleep(qMin(Q_INT64_C(50), interval - slept.elapsed()));
+
+    if( sigint != 0 )
+      break;
+
+    success = sample();
+  }
+
+  signal(SIGINT, previous_handler);
+  signal(SIGTERM, previous_term_handler);
+
+  return success;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef GROWTHSAMPLER_H
+#define GROWTHSAMPLER_H
+
+#include <csignal>
+
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include "SqliteNative.h"
+
+struct BufferGrowth {
+    QString user;
+    QString buffer;
+    qint64 lines;
+};
+
+struct GrowthSample {
+    qint64 time;
+    qint64 page_size;
+    qint64 page_count;
+    qint64 freelist_count;
+    qint64 wal_bytes;
+    qint64 max_messageid;
+    qint64 max_senderid;
+    qint64 max_bufferid;
+
+    // against the previous sample, 0 for the first one
+    qint64 elapsed;
+    qint64 new_lines;
+    qint64 new_pages;
+
+    QList<QPair<QString, qint64> > estimated_rows;
+    QList<QPair<QString, qint64> > object_pages;
+    QList<BufferGrowth> buffers;
+};
+
+/*
+ * Samples the size and growth of the database without scanning it.
+ *
+ * A sample reads the page counters, the WAL size, the highest ids of the
+ * rowid tables and the row estimates of sqlite_stat1 (after ANALYZE). The
+ * buffers that grew most are counted over the messageid range since the
+ * previous sample only, so the cost follows the new lines. The pages per
+ * table and index come from dbstat, which reads every page, and are only
+ * collected with setDetail().
+ *
+ * A sample file ending in .prom is rewritten as a Prometheus textfile,
+ * any other file is a ring of JSONL samples.
+ */
+class GrowthSampler {
+
+public:
+    GrowthSampler(SqliteNative& db, const QString& sample_file, int ring_size = 1440);
+
+    void setDetail(bool enabled) { detail = enabled; }
+
+    bool sample();
+    // samples every interval msecs until SIGINT
+    bool run(int interval);
+
+    const GrowthSample& last() const { return current; }
+    bool hasDbstat();
+
+private:
+
+    bool loadPrevious();
+    bool collect(GrowthSample& sample);
+    bool writeRing(const GrowthSample& sample);
+    bool writePrometheus(const GrowthSample& sample);
+
+    static void onSigint(int);
+    static volatile sig_atomic_t sigint;
+
+    SqliteNative& db;
+    QString sample_file;
+    int ring_size;
+    bool detail;
+    bool prometheus;
+
+    bool has_previous;
+    GrowthSample previous;
+    GrowthSample current;
+};
+
+#endif // GROWTHSAMPLER_H
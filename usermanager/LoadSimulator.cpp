@@ -0,0 +1,401 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+
+#include "LoadSimulator.h"
+#include "BacklogArchive.h"
+#include "BacklogSearch.h"
+#include "GarbageCollector.h"
+#include "Maintenance.h"
+#include "QuasselSchema.h"
+#include "QuasselUser.h"
+#include "UsageQuota.h"
+
+// the scratch database: live users, buffers of deleted users for gc and a year of backlog
+static const int seed_users = 20;
+static const int seed_orphan_users = 5;
+static const int seed_buffers = 10;
+static const int seed_senders = 1000;
+static const int seed_lines = 200000;
+static const qint64 seed_days = 365;
+
+static const int batch_add_users = 500;
+static const int list_rounds = 20;
+static const int idle_msecs = 2000;
+static const qint64 maintain_msecs = 5000;
+
+/*
+ * Writes messages the way the sqlite storage of the core does: one
+ * transaction per message with the sender lookup, the backlog insert and
+ * the lastmsgid update of the buffer, on its own connection and thread.
+ */
+class CoreSimulator {
+
+public:
+    CoreSimulator(const QString& database_file, int rate, const QVector<qint64>& buffers) :
+      db(database_file), rate(rate), buffers(buffers), running(false), failures(0), lock_wait(0) {
+    }
+
+    void start() {
+      clock.start();
+      running = true;
+      thread = std::thread(&CoreSimulator::run, this);
+    }
+
+    void stop() {
+      running = false;
+
+      if( thread.joinable() )
+        thread.join();
+    }
+
+    qint64 now() const { return clock.elapsed(); }
+    qint64 lockWait() const { return lock_wait; }
+    int failed() const { return failures; }
+
+    // usecs from the planned to the committed write of the messages planned between from and to
+    QVector<qint64> latencies(qint64 from, qint64 to) {
+
+      QMutexLocker locker(&mutex);
+      QVector<qint64> result;
+
+      for( const QPair<qint64, qint64>& sample : samples ) {
+        if( sample.first >= from * 1000 && sample.first < to * 1000 )
+          result.append(sample.second);
+      }
+
+      return result;
+    }
+
+private:
+
+    void run() {
+
+      if( !db.open() ) {
+        running = false;
+        return;
+      }
+
+      std::mt19937 generator(42);
+      std::uniform_int_distribution<int> buffer(0, buffers.size() - 1);
+      std::uniform_int_distribution<int> sender(0, seed_senders - 1);
+
+      for( qint64 i = 0; running; i++ ) {
+
+        // the schedule stays fixed, a slow write delays the following ones
+        qint64 planned = i * 1000000 / rate;
+        qint64 wait = planned - clock.nsecsElapsed() / 1000;
+
+        if( wait > 0 )
+          QThread::usleep(wait);
+
+        bool success = write(buffers.at(buffer(generator)), sender(generator), i);
+
+        lock_wait = db.lockWait();
+
+        if( !success ) {
+          failures++;
+          continue;
+        }
+
+        QMutexLocker locker(&mutex);
+        samples.append(qMakePair(planned, clock.nsecsElapsed() / 1000 - planned));
+      }
+
+      db.close();
+    }
+
+    bool write(qint64 bufferid, int sender, qint64 i) {
+
+      if( !db.transaction(false) )
+        return false;
+
+      SqliteStatement* select = db.statement("SELECT senderid FROM sender WHERE sender = ?1 AND realname = '' AND avatarurl = ''");
+      SqliteStatement* insert = db.statement(
+        "INSERT INTO backlog (time, bufferid, type, flags, senderid, senderprefixes, message) VALUES (?1, ?2, 1, 0, ?3, '', ?4)");
+      SqliteStatement* update = db.statement("UPDATE buffer SET lastmsgid = ?1 WHERE bufferid = ?2");
+
+      if( select == nullptr || insert == nullptr || update == nullptr ) {
+        db.rollback();
+        return false;
+      }
+
+      select->bind(1, QString("sender_%1!user@host").arg(sender));
+      qint64 senderid = select->next() ? select->columnInt64(0) : 1;
+      select->reset();
+
+      insert->bind(1, QDateTime::currentMSecsSinceEpoch());
+      insert->bind(2, bufferid);
+      insert->bind(3, senderid);
+      insert->bind(4, QString("simulated core message %1 with some text to make it look like a real line").arg(i));
+
+      if( !insert->exec() ) {
+        db.rollback();
+        return false;
+      }
+
+      update->bind(1, db.lastInsertId());
+      update->bind(2, bufferid);
+
+      if( !update->exec() || !db.commit() ) {
+        db.rollback();
+        return false;
+      }
+
+      return true;
+    }
+
+    SqliteNative db;
+    int rate;
+    QVector<qint64> buffers;
+
+    QElapsedTimer clock;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<int> failures;
+    std::atomic<qint64> lock_wait;
+
+    QMutex mutex;
+    QVector<QPair<qint64, qint64> > samples;
+};
+
+static bool seedDatabase(SqliteNative& db, QVector<qint64>& live_buffers) {
+
+  if( !createQuasselSchema(db) || !db.transaction() )
+    return false;
+
+  SqliteStatement* user = db.statement("INSERT INTO quasseluser (userid, username, password, hashversion) VALUES (?1, ?2, 'x:y', 1)");
+  SqliteStatement* network = db.statement("INSERT INTO network (userid, networkname) VALUES (?1, 'simnet')");
+  SqliteStatement* buffer = db.statement(
+    "INSERT INTO buffer (userid, networkid, buffername, buffercname, buffertype) VALUES (?1, ?2, ?3, ?3, 2)");
+  SqliteStatement* sender = db.statement("INSERT INTO sender (sender, realname, avatarurl) VALUES (?1, '', '')");
+  SqliteStatement* line = db.statement(
+    "INSERT INTO backlog (time, bufferid, type, flags, senderid, senderprefixes, message) VALUES (?1, ?2, 1, 0, ?3, '', ?4)");
+
+  if( user == nullptr || network == nullptr || buffer == nullptr || sender == nullptr || line == nullptr ) {
+    db.rollback();
+    return false;
+  }
+
+  QVector<qint64> all_buffers;
+  bool success = true;
+
+  for( int u = 1; u <= seed_users + seed_orphan_users; u++ ) {
+
+    // the orphans own buffers and backlog, but no quasseluser row
+    if( u <= seed_users ) {
+      user->bind(1, u);
+      user->bind(2, QString("sim_%1").arg(u));
+      success = success && user->exec();
+    }
+
+    network->bind(1, u);
+    success = success && network->exec();
+    qint64 networkid = db.lastInsertId();
+
+    for( int b = 0; b < seed_buffers; b++ ) {
+      buffer->bind(1, u);
+      buffer->bind(2, networkid);
+      buffer->bind(3, QString("#sim_%1_%2").arg(u).arg(b));
+      success = success && buffer->exec();
+
+      all_buffers.append(db.lastInsertId());
+
+      if( u <= seed_users )
+        live_buffers.append(db.lastInsertId());
+    }
+  }
+
+  for( int s = 0; s < seed_senders; s++ ) {
+    sender->bind(1, QString("sender_%1!user@host").arg(s));
+    success = success && sender->exec();
+  }
+
+  std::mt19937 generator(23);
+  std::uniform_int_distribution<int> pick_buffer(0, all_buffers.size() - 1);
+  std::uniform_int_distribution<int> pick_sender(1, seed_senders);
+
+  qint64 start = QDateTime::currentMSecsSinceEpoch() - seed_days * 24 * 3600 * 1000;
+  qint64 step = seed_days * 24 * 3600 * 1000 / seed_lines;
+
+  for( int i = 0; i < seed_lines && success; i++ ) {
+    line->bind(1, start + i * step);
+    line->bind(2, all_buffers.at(pick_buffer(generator)));
+    line->bind(3, qint64(pick_sender(generator)));
+    line->bind(4, QString("seeded line %1 about nothing in particular, just text of a usual length").arg(i));
+    success = line->exec();
+  }
+
+  if( !success ) {
+    std::cerr
+      << "ERROR: "
+      << "Unable to seed the simulation database"
+      << std::endl
+      << "-"
+      << db.lastError().toStdString()
+      << std::endl;
+
+    db.rollback();
+    return false;
+  }
+
+  return db.commit();
+}
+
+static double percentile(const QVector<qint64>& sorted, double p) {
+
+  if( sorted.isEmpty() )
+    return 0;
+
+  int rank = qMax(1, int(( p / 100.0 ) * sorted.size() + 0.999999));
+
+  return sorted.at(rank - 1) / 1000.0;
+}
+
+static void printOperation(const char* name, CoreSimulator& core, qint64 from, qint64 to,
+                           qint64 tool_wait, qint64 core_wait, int core_failed, bool success) {
+
+  QVector<qint64> latencies = core.latencies(from, to);
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout
+    << "  " << std::left << std::setw(10) << name << std::right
+    << std::fixed << std::setprecision(2)
+    << " time " << ( to - from ) << " ms"
+    << ", tool lock wait " << tool_wait << " ms"
+    << ", core writes " << latencies.size()
+    << ", p50 " << percentile(latencies, 50) << " ms"
+    << ", p99 " << percentile(latencies, 99) << " ms"
+    << ", max " << ( latencies.isEmpty() ? 0 : latencies.last() / 1000.0 ) << " ms"
+    << ", core lock wait " << core_wait << " ms"
+    << ", failed " << core_failed
+    << ( success ? "" : " (operation failed)" )
+    << std::endl;
+}
+
+int runLoadSimulation(int rate, int batch_size) {
+
+  QTemporaryDir dir;
+
+  if( !dir.isValid() ) {
+    std::cerr
+      << "unable to create a temporary directory.\n"
+      << std::endl;
+    return 1;
+  }
+
+  QString database_file = dir.filePath("simulation.sqlite");
+  QVector<qint64> live_buffers;
+
+  {
+    SqliteNative seed(database_file);
+
+    if( !seed.open(true) || !seedDatabase(seed, live_buffers) )
+      return 1;
+  }
+
+  QuasselUser qu(database_file);
+  qu.setNativeBackend(true);
+
+  SqliteNative* db = qu.nativeDb();
+
+  if( db == nullptr )
+    return 1;
+
+  QList<QPair<QString, QString> > users;
+
+  for( int i = 0; i < batch_add_users; i++ )
+    users.append(qMakePair(QString("added_%1").arg(i), QString("secret_%1").arg(i)));
+
+  std::cout
+    << "load simulation with " << rate << " messages/s, "
+    << seed_lines << " backlog lines, batch size " << batch_size
+    << std::endl;
+
+  CoreSimulator core(database_file, rate, live_buffers);
+  core.start();
+
+  const char* const operations[] = { "idle", "batch add", "list", "gc", "index", "quota", "archive", "maintain", nullptr };
+
+  for( int i = 0; operations[i] != nullptr; i++ ) {
+
+    QString operation = operations[i];
+
+    qint64 from = core.now();
+    qint64 tool_wait = db->lockWait();
+    qint64 core_wait = core.lockWait();
+    int core_failed = core.failed();
+    bool success = true;
+
+    if( operation == "idle" ) {
+      QThread::msleep(idle_msecs);
+    } else
+    if( operation == "batch add" ) {
+      success = ( qu.addUsers(users) == users.size() );
+    } else
+    if( operation == "list" ) {
+      for( int round = 0; round < list_rounds; round++ )
+        success = success && !qu.getAllAuthUserNames().isEmpty();
+    } else
+    if( operation == "gc" ) {
+      GarbageCollector gc(*db, batch_size);
+      success = gc.run();
+    } else
+    if( operation == "index" ) {
+      BacklogSearch search(*db, database_file + ".fts", batch_size);
+      success = search.attach() && search.update();
+    } else
+    if( operation == "quota" ) {
+      UsageQuota usage(*db, database_file + ".usage", batch_size);
+      success = usage.attach() && usage.update();
+    } else
+    if( operation == "archive" ) {
+      BacklogArchive archive(*db, database_file + ".archive", batch_size);
+      qint64 cutoff = QDateTime::currentMSecsSinceEpoch() - seed_days / 2 * 24 * 3600 * 1000;
+      success = archive.attach() && archive.archive(cutoff);
+    } else
+    if( operation == "maintain" ) {
+      MaintenanceRunner runner(*db, database_file + ".maintenance", batch_size, maintain_msecs, 200);
+      success = runner.attach() && runner.run();
+    }
+
+    printOperation(operations[i], core, from, core.now(),
+                   db->lockWait() - tool_wait, core.lockWait() - core_wait, core.failed() - core_failed, success);
+  }
+
+  core.stop();
+
+  return 0;
+}
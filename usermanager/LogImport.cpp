@@ -0,0 +1,1026 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <QDate>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QThread>
+
+#include "LogImport.h"
+#include "QuasselSchema.h"
+
+// Message::Type of the core
+enum MessageType {
+  MessagePlain  = 0x00001,
+  MessageNotice = 0x00002,
+  MessageAction = 0x00004,
+  MessageNick   = 0x00008,
+  MessageJoin   = 0x00020,
+  MessagePart   = 0x00040,
+  MessageQuit   = 0x00080,
+  MessageServer = 0x00400,
+  MessageError  = 0x01000
+};
+
+// BufferInfo::Type of the core
+enum BufferType {
+  StatusBuffer  = 0x01,
+  ChannelBuffer = 0x02,
+  QueryBuffer   = 0x04
+};
+
+enum LogFormat {
+  UnknownLog,
+  IrssiLog,
+  WeechatLog,
+  ZncLog
+};
+
+enum LineResult {
+  LineMessage,
+  LineControl,
+  LineSkipped
+};
+
+// chunks per worker the queue may hold before the workers wait for the writer
+static const int queue_depth = 4;
+
+static const char* const month_names[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static bool isDigits(const QString& text, int from, int count) {
+
+  if( from < 0 || text.size() < from + count )
+    return false;
+
+  for( int i = from; i < from + count; i++ ) {
+    if( !text.at(i).isDigit() )
+      return false;
+  }
+
+  return true;
+}
+
+static int number(const QString& text, int from, int count) {
+
+  int value = 0;
+
+  for( int i = from; i < from + count; i++ )
+    value = value * 10 + text.at(i).digitValue();
+
+  return value;
+}
+
+/**
+ * "HH:MM" or "HH:MM:SS" at from, returns the seconds of the day or -1
+ */
+static int parseClock(const QString& line, int from, int& length) {
+
+  if( !isDigits(line, from, 2) || line.size() < from + 5 || line.at(from + 2) != ':' || !isDigits(line, from + 3, 2) )
+    return -1;
+
+  int secs = number(line, from, 2) * 3600 + number(line, from + 3, 2) * 60;
+  length = 5;
+
+  if( line.size() >= from + 8 && line.at(from + 5) == ':' && isDigits(line, from + 6, 2) ) {
+    secs += number(line, from + 6, 2);
+    length = 8;
+  }
+
+  return secs;
+}
+
+// local midnight, one conversion per day instead of one per line
+static qint64 dayStart(const QDate& date) {
+  return date.isValid() ? QDateTime(date, QTime(0, 0)).toMSecsSinceEpoch() : -1;
+}
+
+/**
+ * irssi writes "Mon Jan 21 10:00:00 2019" and "Tue Jan 22 2019" in English
+ */
+static QDate parseIrssiDate(const QString& text) {
+
+  QStringList parts = text.split(' ', QString::SkipEmptyParts);
+
+  if( parts.size() < 4 )
+    return QDate();
+
+  int month = 0;
+
+  for( int i = 0; i < 12; i++ ) {
+    if( parts.at(1) == month_names[i] )
+      month = i + 1;
+  }
+
+  return QDate(parts.last().toInt(), month, parts.at(2).toInt());
+}
+
+// "YYYY-MM-DD" or "YYYYMMDD" at the end of a ZNC log name
+static QDate parseFileDate(const QString& name) {
+
+  if( name.size() >= 10 && isDigits(name, name.size() - 10, 4) && name.at(name.size() - 6) == '-' )
+    return QDate::fromString(name.right(10), "yyyy-MM-dd");
+
+  if( isDigits(name, name.size() - 8, 8) )
+    return QDate::fromString(name.right(8), "yyyyMMdd");
+
+  return QDate();
+}
+
+static QString unbracket(const QString& text) {
+
+  QString value = text.trimmed();
+
+  if( value.size() >= 2 && ( value.startsWith('[') || value.startsWith('(') ) && ( value.endsWith(']') || value.endsWith(')') ) )
+    return value.mid(1, value.size() - 2);
+
+  return value;
+}
+
+/**
+ * "nick [user@host] ..." (irssi) or "nick (user@host) ..." (weechat, ZNC)
+ * becomes the sender "nick!user@host" of the core, end points behind it
+ */
+static QString parseSender(const QString& text, int& end) {
+
+  int space = text.indexOf(' ');
+
+  if( space < 0 ) {
+    end = text.size();
+    return text;
+  }
+
+  end = space;
+
+  if( space + 1 < text.size() && ( text.at(space + 1) == '[' || text.at(space + 1) == '(' ) ) {
+    int close = text.indexOf(text.at(space + 1) == '[' ? ']' : ')', space + 2);
+
+    if( close > 0 ) {
+      end = close + 1;
+      return text.left(space) + "!" + text.mid(space + 2, close - space - 2);
+    }
+  }
+
+  return text.left(space);
+}
+
+static void parseNick(const QString& nick, ImportLine& line) {
+
+  int i = 0;
+
+  while( i < nick.size() && QString("@+%~&! ").contains(nick.at(i)) )
+    i++;
+
+  line.prefixes = nick.left(i).trimmed();
+  line.sender = nick.mid(i).trimmed();
+}
+
+/**
+ * join, part, quit and nick events of all three formats, everything else
+ * is kept as server message
+ */
+static void parseEvent(const QString& text, const QString& buffer, ImportLine& line) {
+
+  QString event = text;
+
+  // ZNC: "Joins: nick (host)", "Parts: nick (host) (reason)", "Quits: nick (host) (reason)"
+  if( event.startsWith("Joins: ") )
+    event = event.mid(7) + " has joined " + buffer;
+  else if( event.startsWith("Parts: ") )
+    event = event.mid(7).replace(QRegExp("^(\\S+ \\([^)]*\\))"), "\\1 has left " + buffer);
+  else if( event.startsWith("Quits: ") )
+    event = event.mid(7).replace(QRegExp("^(\\S+ \\([^)]*\\))"), "\\1 has quit");
+
+  int end = 0;
+  QString sender = parseSender(event, end);
+  QString rest = event.mid(end).trimmed();
+
+  if( rest.startsWith("has joined ") ) {
+    line.type = MessageJoin;
+    line.sender = sender;
+    line.message = rest.mid(11).trimmed();
+  } else
+  if( rest.startsWith("has left ") ) {
+    line.type = MessagePart;
+    line.sender = sender;
+    line.message = unbracket(rest.mid(9).section(' ', 1));
+  } else
+  if( rest.startsWith("has quit") ) {
+    line.type = MessageQuit;
+    line.sender = sender;
+    line.message = unbracket(rest.mid(8));
+  } else
+  if( rest.startsWith("is now known as ") ) {
+    line.type = MessageNick;
+    line.sender = sender.section('!', 0, 0);
+    line.message = rest.mid(16).trimmed();
+  } else {
+    line.type = MessageServer;
+    line.sender = "";
+    line.message = text;
+  }
+}
+
+static LineResult parseIrssi(const QString& text, const QString& buffer, qint64& day, ImportLine& line) {
+
+  if( text.startsWith("--- ") ) {
+    int opened = text.indexOf("Log opened ");
+    int changed = text.indexOf("Day changed ");
+
+    if( opened > 0 )
+      day = dayStart(parseIrssiDate(text.mid(opened + 11)));
+    else if( changed > 0 )
+      day = dayStart(parseIrssiDate(text.mid(changed + 12)));
+
+    return LineControl;
+  }
+
+  int length = 0;
+  int secs = parseClock(text, 0, length);
+
+  if( secs < 0 || day < 0 || text.size() < length + 2 )
+    return LineSkipped;
+
+  line.time = day + secs * Q_INT64_C(1000);
+  line.prefixes = "";
+
+  QString rest = text.mid(length + 1);
+
+  if( rest.startsWith('<') ) {
+    int close = rest.indexOf("> ");
+
+    if( close < 0 )
+      return LineSkipped;
+
+    line.type = MessagePlain;
+    parseNick(rest.mid(1, close - 1), line);
+    line.message = rest.mid(close + 2);
+  } else
+  if( rest.startsWith(" * ") ) {
+    line.type = MessageAction;
+    line.sender = rest.mid(3).section(' ', 0, 0);
+    line.message = rest.mid(3).section(' ', 1);
+  } else
+  if( rest.startsWith("-!- ") ) {
+    parseEvent(rest.mid(4), buffer, line);
+  } else
+  if( rest.startsWith('-') && rest.indexOf("- ") > 1 ) {
+    // "-nick(user@host)- text" or "-nick:#channel- text"
+    int close = rest.indexOf("- ");
+
+    line.type = MessageNotice;
+    line.sender = rest.mid(1, close - 1).section(QRegExp("[(:]"), 0, 0);
+    line.message = rest.mid(close + 2);
+  } else {
+    return LineSkipped;
+  }
+
+  return LineMessage;
+}
+
+static LineResult parseWeechat(const QString& text, const QString& buffer, QDate& date, qint64& day, ImportLine& line) {
+
+  // "YYYY-MM-DD HH:MM:SS<tab>prefix<tab>message"
+  if( text.size() < 21 || !isDigits(text, 0, 4) || text.at(4) != '-' || text.at(10) != ' ' || text.at(19) != '\t' )
+    return LineSkipped;
+
+  QDate current(number(text, 0, 4), number(text, 5, 2), number(text, 8, 2));
+
+  if( current != date ) {
+    date = current;
+    day = dayStart(date);
+  }
+
+  int length = 0;
+  int secs = parseClock(text, 11, length);
+  int tab = text.indexOf('\t', 20);
+
+  if( secs < 0 || day < 0 || tab < 0 )
+    return LineSkipped;
+
+  line.time = day + secs * Q_INT64_C(1000);
+  line.prefixes = "";
+
+  QString prefix = text.mid(20, tab - 20);
+  QString message = text.mid(tab + 1);
+
+  if( prefix == "-->" || prefix == "<--" || prefix == "--" ) {
+    parseEvent(message, buffer, line);
+  } else
+  if( prefix.trimmed() == "*" ) {
+    line.type = MessageAction;
+    line.sender = message.section(' ', 0, 0);
+    line.message = message.section(' ', 1);
+  } else
+  if( prefix == "=!=" ) {
+    line.type = MessageError;
+    line.sender = "";
+    line.message = message;
+  } else
+  if( prefix.isEmpty() ) {
+    line.type = MessageServer;
+    line.sender = "";
+    line.message = message;
+  } else {
+    line.type = MessagePlain;
+    parseNick(prefix, line);
+    line.message = message;
+  }
+
+  return LineMessage;
+}
+
+static LineResult parseZnc(const QString& text, const QString& buffer, qint64 day, ImportLine& line) {
+
+  int length = 0;
+  int secs = text.startsWith('[') ? parseClock(text, 1, length) : -1;
+
+  if( secs < 0 || day < 0 || text.size() < length + 4 || text.at(length + 1) != ']' )
+    return LineSkipped;
+
+  line.time = day + secs * Q_INT64_C(1000);
+  line.prefixes = "";
+
+  QString rest = text.mid(length + 3);
+
+  if( rest.startsWith('<') ) {
+    int close = rest.indexOf("> ");
+
+    if( close < 0 )
+      return LineSkipped;
+
+    line.type = MessagePlain;
+    parseNick(rest.mid(1, close - 1), line);
+    line.message = rest.mid(close + 2);
+  } else
+  if( rest.startsWith("*** ") ) {
+    parseEvent(rest.mid(4), buffer, line);
+  } else
+  if( rest.startsWith("* ") ) {
+    line.type = MessageAction;
+    line.sender = rest.mid(2).section(' ', 0, 0);
+    line.message = rest.mid(2).section(' ', 1);
+  } else
+  if( rest.startsWith('-') && rest.indexOf("- ") > 1 ) {
+    int close = rest.indexOf("- ");
+
+    line.type = MessageNotice;
+    line.sender = rest.mid(1, close - 1);
+    line.message = rest.mid(close + 2);
+  } else {
+    return LineSkipped;
+  }
+
+  return LineMessage;
+}
+
+static int detectFormat(QFile& file) {
+
+  for( int i = 0; i < 20 && !file.atEnd(); i++ ) {
+    QString line = QString::fromUtf8(file.readLine());
+    int length = 0;
+
+    if( line.startsWith("--- Log opened ") || line.startsWith("--- Day changed ") )
+      return IrssiLog;
+
+    if( line.size() > 20 && isDigits(line, 0, 4) && line.at(4) == '-' && line.at(10) == ' ' && line.at(19) == '\t' )
+      return WeechatLog;
+
+    if( line.startsWith('[') && parseClock(line, 1, length) >= 0 && line.size() > length + 1 && line.at(length + 1) == ']' )
+      return ZncLog;
+  }
+
+  return UnknownLog;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+LogImport::LogImport(SqliteNative& database, uint user, int size, int thread_count) :
+  db(database), userid(user), batch_size(size), threads(thread_count), force(false), file_count(0),
+  running_workers(0), next_group(0), aborted(false), skipped_lines(0),
+  time_divisor(1), imported_rows(0) {
+}
+
+bool LogImport::addPath(const QString& path) {
+
+  QFileInfo info(path);
+
+  if( !info.exists() ) {
+    std::cerr
+      << "the log path " << path.toStdString() << " does not exist."
+      << std::endl;
+    return false;
+  }
+
+  if( info.isFile() )
+    return addFile(info.absoluteFilePath());
+
+  QDirIterator it(path, QDir::Files, QDirIterator::Subdirectories);
+
+  while( it.hasNext() )
+    addFile(it.next());
+
+  return true;
+}
+
+/**
+ * the network and buffer come from the default log paths of the clients:
+ *   irssi    <network>/<buffer>.log
+ *   weechat  irc.<network>.<buffer>.weechatlog, irc.server.<network>.weechatlog
+ *   ZNC      <network>/<buffer>/YYYY-MM-DD.log, <user>_<network>_<buffer>_YYYYMMDD.log
+ */
+bool LogImport::addFile(const QString& path) {
+
+  QFile file(path);
+
+  if( !file.open(QIODevice::ReadOnly | QIODevice::Text) ) {
+    std::cerr
+      << "skip unreadable log file " << path.toStdString()
+      << std::endl;
+    return false;
+  }
+
+  int format = detectFormat(file);
+
+  QFileInfo info(path);
+  QString network;
+  QString buffer;
+
+  if( format == IrssiLog ) {
+    QRegExp dated("^(.+)[-_.]\\d{4}-?\\d{2}(-?\\d{2})?$");
+
+    network = info.dir().dirName();
+    buffer = dated.exactMatch(info.completeBaseName()) ? dated.cap(1) : info.completeBaseName();
+  } else
+  if( format == WeechatLog ) {
+    QStringList parts = info.completeBaseName().split('.');
+
+    if( parts.size() >= 3 && parts.at(0) == "irc" ) {
+      if( parts.at(1) == "server" ) {
+        network = parts.mid(2).join(".");
+      } else {
+        network = parts.at(1);
+        buffer = parts.mid(2).join(".");
+      }
+    }
+  } else
+  if( format == ZncLog ) {
+    QString name = info.completeBaseName();
+
+    if( QRegExp("\\d{4}-\\d{2}-\\d{2}").exactMatch(name) ) {
+      buffer = info.dir().dirName();
+      network = QFileInfo(info.absolutePath()).dir().dirName();
+    } else {
+      QStringList parts = name.split('_');
+
+      if( parts.size() >= 4 ) {
+        network = parts.at(1);
+        buffer = parts.mid(2, parts.size() - 3).join("_");
+      }
+    }
+  }
+
+  if( !network_override.isEmpty() )
+    network = network_override;
+
+  if( format == UnknownLog || network.isEmpty() ) {
+    std::cerr
+      << "skip log file of unknown format or path " << path.toStdString()
+      << std::endl;
+    return false;
+  }
+
+  QString key = network.toLower() + "\n" + buffer.toLower();
+  int index = group_index.value(key, -1);
+
+  if( index < 0 ) {
+    ImportGroup group = { format, network, buffer, QStringList() };
+
+    index = groups.size();
+    groups.append(group);
+    group_index.insert(key, index);
+  }
+
+  groups[index].files.append(path);
+  file_count++;
+
+  return true;
+}
+
+bool LogImport::run() {
+
+  if( groups.isEmpty() ) {
+    std::cerr
+      << "no log files to import."
+      << std::endl;
+    return false;
+  }
+
+  // dated file names sort by time
+  for( ImportGroup& group : groups )
+    std::sort(group.files.begin(), group.files.end());
+
+  time_divisor = backlogTimeDivisor(db);
+
+  if( threads <= 0 )
+    threads = QThread::idealThreadCount();
+
+  threads = qBound(1, threads, groups.size());
+
+  running_workers = threads;
+  next_group = 0;
+  aborted = false;
+
+  std::vector<std::thread> workers;
+
+  for( int i = 0; i < threads; i++ )
+    workers.emplace_back(&LogImport::parseGroups, this);
+
+  bool success = true;
+
+  forever {
+
+    ImportChunk chunk;
+
+    {
+      QMutexLocker locker(&mutex);
+
+      while( queue.isEmpty() && running_workers > 0 )
+        queue_not_empty.wait(&mutex);
+
+      if( queue.isEmpty() )
+        break;
+
+      chunk = queue.takeFirst();
+      queue_not_full.wakeAll();
+    }
+
+    if( !write(chunk) ) {
+      success = false;
+      break;
+    }
+  }
+
+  if( !success ) {
+    QMutexLocker locker(&mutex);
+
+    aborted = true;
+    queue.clear();
+    queue_not_full.wakeAll();
+  }
+
+  for( std::thread& worker : workers )
+    worker.join();
+
+  // the buffers of the committed batches are finished even after a failure
+  bool finished = finishBuffers();
+
+  return success && finished;
+}
+
+void LogImport::parseGroups() {
+
+  QVector<ImportLine> lines;
+
+  forever {
+
+    int index = next_group++;
+
+    if( index >= groups.size() || aborted )
+      break;
+
+    for( const QString& file : groups.at(index).files ) {
+
+      if( aborted )
+        break;
+
+      parseFile(groups.at(index), file, index, lines);
+    }
+
+    if( !lines.isEmpty() )
+      push(index, lines);
+  }
+
+  QMutexLocker locker(&mutex);
+
+  running_workers--;
+  queue_not_empty.wakeAll();
+}
+
+void LogImport::parseFile(const ImportGroup& group, const QString& path, int index, QVector<ImportLine>& lines) {
+
+  QFile file(path);
+
+  if( !file.open(QIODevice::ReadOnly | QIODevice::Text) )
+    return;
+
+  QString name = QFileInfo(path).completeBaseName();
+  QDate date;
+  qint64 day = ( group.format == ZncLog ) ? dayStart(parseFileDate(name)) : -1;
+  qint64 skipped = 0;
+
+  ImportLine line;
+
+  while( !file.atEnd() && !aborted ) {
+
+    QString text = QString::fromUtf8(file.readLine());
+
+    while( text.endsWith('\n') || text.endsWith('\r') )
+      text.chop(1);
+
+    if( text.isEmpty() )
+      continue;
+
+    LineResult result = LineSkipped;
+
+    if( group.format == IrssiLog )
+      result = parseIrssi(text, group.buffer, day, line);
+    else if( group.format == WeechatLog )
+      result = parseWeechat(text, group.buffer, date, day, line);
+    else
+      result = parseZnc(text, group.buffer, day, line);
+
+    if( result == LineSkipped )
+      skipped++;
+
+    if( result != LineMessage )
+      continue;
+
+    lines.append(line);
+
+    if( lines.size() >= batch_size )
+      push(index, lines);
+  }
+
+  skipped_lines += skipped;
+}
+
+void LogImport::push(int index, QVector<ImportLine>& lines) {
+
+  QMutexLocker locker(&mutex);
+
+  while( queue.size() >= threads * queue_depth && !aborted )
+    queue_not_full.wait(&mutex);
+
+  if( !aborted ) {
+    ImportChunk chunk;
+
+    chunk.group = index;
+    chunk.lines.swap(lines);
+
+    queue.append(chunk);
+    queue_not_empty.wakeOne();
+  }
+
+  lines.clear();
+  lines.reserve(batch_size);
+}
+
+bool LogImport::write(const ImportChunk& chunk) {
+
+  if( refused_groups.contains(chunk.group) )
+    return true;
+
+  if( !db.transaction() )
+    return false;
+
+  qint64 bufferid = bufferId(chunk.group, chunk.lines.first().time / time_divisor);
+
+  if( bufferid == 0 && refused_groups.contains(chunk.group) ) {
+    db.rollback();
+    return true;
+  }
+
+  SqliteStatement* insert = db.statement(
+    "INSERT INTO backlog (time, bufferid, type, flags, senderid, senderprefixes, message) VALUES (?1, ?2, ?3, 0, ?4, ?5, ?6)");
+
+  if( bufferid == 0 || insert == nullptr ) {
+    db.rollback();
+    return false;
+  }
+
+  for( const ImportLine& line : chunk.lines ) {
+
+    qint64 senderid = senderId(line.sender);
+
+    if( senderid == 0 ) {
+      db.rollback();
+      return false;
+    }
+
+    insert->bind(1, line.time / time_divisor);
+    insert->bind(2, bufferid);
+    insert->bind(3, line.type);
+    insert->bind(4, senderid);
+    insert->bind(5, line.prefixes);
+    insert->bind(6, line.message);
+
+    if( !insert->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to import into buffer " << groups.at(chunk.group).buffer.toStdString()
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+  }
+
+  if( !db.commit() )
+    return false;
+
+  written_buffers.insert(bufferid);
+  imported_rows += chunk.lines.size();
+
+  return true;
+}
+
+/**
+ * the first chunk of a buffer carries its oldest line, it decides whether
+ * the buffer can take the logs without breaking the messageid order
+ */
+qint64 LogImport::bufferId(int index, qint64 first_time) {
+
+  qint64 bufferid = buffer_ids.value(index, 0);
+
+  if( bufferid != 0 )
+    return bufferid;
+
+  const ImportGroup& group = groups.at(index);
+  qint64 networkid = networkId(group.network);
+
+  if( networkid == 0 )
+    return 0;
+
+  SqliteStatement* select = db.statement("SELECT bufferid FROM buffer WHERE userid = ?1 AND networkid = ?2 AND buffercname = ?3");
+
+  if( select == nullptr )
+    return 0;
+
+  select->bind(1, qint64(userid));
+  select->bind(2, networkid);
+  select->bind(3, group.buffer.toLower());
+
+  if( select->next() )
+    bufferid = select->columnInt64(0);
+
+  select->reset();
+
+  if( bufferid != 0 ) {
+    SqliteStatement* last = db.statement("SELECT time FROM backlog WHERE bufferid = ?1 ORDER BY messageid DESC LIMIT 1");
+
+    if( last == nullptr )
+      return 0;
+
+    last->bind(1, bufferid);
+    qint64 last_time = last->next() ? last->columnInt64(0) : -1;
+    last->reset();
+
+    if( last_time > first_time && !force ) {
+      std::cerr
+        << "skipping buffer " << group.buffer.toStdString() << ", it has lines newer than the logs"
+        << " or was imported already (use --force to import anyway)"
+        << std::endl;
+
+      refused_groups.insert(index);
+      return 0;
+    }
+
+    existing_buffers.append(bufferid);
+  }
+
+  if( bufferid == 0 ) {
+    SqliteStatement* insert = db.statement(
+      "INSERT INTO buffer (userid, networkid, buffername, buffercname, buffertype, joined) VALUES (?1, ?2, ?3, ?4, ?5, 0)");
+
+    if( insert == nullptr )
+      return 0;
+
+    int type = QueryBuffer;
+
+    if( group.buffer.isEmpty() )
+      type = StatusBuffer;
+    else if( QString("#&!+").contains(group.buffer.at(0)) )
+      type = ChannelBuffer;
+
+    insert->bind(1, qint64(userid));
+    insert->bind(2, networkid);
+    insert->bind(3, group.buffer);
+    insert->bind(4, group.buffer.toLower());
+    insert->bind(5, type);
+
+    if( !insert->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to create buffer " << group.buffer.toStdString()
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+      return 0;
+    }
+
+    bufferid = db.lastInsertId();
+    created_buffers.append(bufferid);
+  }
+
+  buffer_ids.insert(index, bufferid);
+
+  return bufferid;
+}
+
+qint64 LogImport::networkId(const QString& network) {
+
+  qint64 networkid = network_ids.value(network.toLower(), 0);
+
+  if( networkid != 0 )
+    return networkid;
+
+  SqliteStatement* select = db.statement("SELECT networkid FROM network WHERE userid = ?1 AND lower(networkname) = lower(?2)");
+
+  if( select == nullptr )
+    return 0;
+
+  select->bind(1, qint64(userid));
+  select->bind(2, network);
+
+  if( select->next() )
+    networkid = select->columnInt64(0);
+
+  select->reset();
+
+  if( networkid == 0 ) {
+    SqliteStatement* insert = db.statement(
+      "INSERT INTO network (userid, networkname, identityid) VALUES (?1, ?2, (SELECT min(identityid) FROM identity WHERE userid = ?1))");
+
+    if( insert == nullptr )
+      return 0;
+
+    insert->bind(1, qint64(userid));
+    insert->bind(2, network);
+
+    if( !insert->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to create network " << network.toStdString()
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+      return 0;
+    }
+
+    networkid = db.lastInsertId();
+  }
+
+  network_ids.insert(network.toLower(), networkid);
+
+  return networkid;
+}
+
+/**
+ * the core looks senders up with empty, not NULL, realname and avatarurl
+ */
+qint64 LogImport::senderId(const QString& sender) {
+
+  QHash<QString, qint64>::const_iterator it = sender_ids.constFind(sender);
+
+  if( it != sender_ids.constEnd() )
+    return it.value();
+
+  qint64 senderid = 0;
+
+  SqliteStatement* select = db.statement("SELECT senderid FROM sender WHERE sender = ?1 AND realname = '' AND avatarurl = ''");
+
+  if( select == nullptr )
+    return 0;
+
+  select->bind(1, sender);
+
+  if( select->next() )
+    senderid = select->columnInt64(0);
+
+  select->reset();
+
+  if( senderid == 0 ) {
+    SqliteStatement* insert = db.statement("INSERT INTO sender (sender, realname, avatarurl) VALUES (?1, '', '')");
+
+    if( insert == nullptr )
+      return 0;
+
+    insert->bind(1, sender);
+
+    if( !insert->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to add the sender " << sender.toStdString()
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+      return 0;
+    }
+
+    senderid = db.lastInsertId();
+  }
+
+  sender_ids.insert(sender, senderid);
+
+  return senderid;
+}
+
+/**
+ * buffers created by the import start with everything read, existing
+ * buffers only move on when they were read up to their last line
+ *
+ * only buffers with committed lines are touched, a buffer created in a
+ * batch that was rolled back does not exist
+ */
+bool LogImport::finishBuffers() {
+
+  if( written_buffers.isEmpty() )
+    return true;
+
+  if( !db.transaction() )
+    return false;
+
+  SqliteStatement* update = db.statement(
+    "UPDATE buffer SET lastmsgid = (SELECT coalesce(max(messageid), 0) FROM backlog WHERE bufferid = ?1),"
+    "                  lastseenmsgid = (SELECT coalesce(max(messageid), 0) FROM backlog WHERE bufferid = ?1)"
+    " WHERE bufferid = ?1");
+
+  SqliteStatement* update_existing = db.statement(
+    "UPDATE buffer SET lastseenmsgid = CASE WHEN lastseenmsgid >= lastmsgid"
+    "                    THEN (SELECT coalesce(max(messageid), 0) FROM backlog WHERE bufferid = ?1)"
+    "                    ELSE lastseenmsgid END,"
+    "                  lastmsgid = (SELECT coalesce(max(messageid), 0) FROM backlog WHERE bufferid = ?1)"
+    " WHERE bufferid = ?1");
+
+  if( update == nullptr || update_existing == nullptr ) {
+    db.rollback();
+    return false;
+  }
+
+  for( qint64 bufferid : created_buffers ) {
+
+    if( !written_buffers.contains(bufferid) )
+      continue;
+
+    update->bind(1, bufferid);
+
+    if( !update->exec() ) {
+      db.rollback();
+      return false;
+    }
+  }
+
+  for( qint64 bufferid : existing_buffers ) {
+
+    if( !written_buffers.contains(bufferid) )
+      continue;
+
+    update_existing->bind(1, bufferid);
+
+    if( !update_existing->exec() ) {
+      db.rollback();
+      return false;
+    }
+  }
+
+  return db.commit();
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef LOGIMPORT_H
+#define LOGIMPORT_H
+
+#include <atomic>
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "SqliteNative.h"
+
+struct ImportLine {
+    qint64 time;        // msecs since epoch
+    int type;           // Message::Type of the core
+    QString sender;
+    QString prefixes;
+    QString message;
+};
+
+// all log files of one buffer, parsed by a single worker in file name order
+struct ImportGroup {
+    int format;
+    QString network;
+    QString buffer;
+    QStringList files;
+};
+
+struct ImportChunk {
+    int group;
+    QVector<ImportLine> lines;
+};
+
+/*
+ * Imports irssi, weechat and ZNC text logs into the backlog of one user.
+ *
+ * Worker threads parse the buffers in parallel and hand chunks of
+ * batch_size lines to a bounded queue, the calling thread is the only
+ * writer: it resolves networks, buffers and senders through in-memory maps
+ * and inserts every chunk in its own write transaction. A buffer is parsed
+ * by one worker in file name order, so its messageids follow the log time.
+ *
+ * The core orders the backlog by messageid, so the imported lines always
+ * come after the lines a buffer already has. A buffer whose last line is
+ * newer than the first imported one is skipped unless setForce() is given,
+ * this also skips the buffers a previous run already imported, so an
+ * aborted import can be run again.
+ */
+class LogImport {
+
+public:
+    LogImport(SqliteNative& db, uint userid, int batch_size = 5000, int threads = 0);
+
+    // replaces the network taken from the log paths
+    void setNetwork(const QString& network) { network_override = network; }
+    // imports into buffers that have newer lines than the logs
+    void setForce(bool enabled) { force = enabled; }
+
+    // a log file or a directory with log files
+    bool addPath(const QString& path);
+    bool run();
+
+    int files() const { return file_count; }
+    int buffers() const { return groups.size(); }
+    qint64 importedRows() const { return imported_rows; }
+    qint64 skippedLines() const { return skipped_lines; }
+    int refusedBuffers() const { return refused_groups.size(); }
+
+private:
+
+    bool addFile(const QString& file);
+    void parseGroups();
+    void parseFile(const ImportGroup& group, const QString& file, int index, QVector<ImportLine>& lines);
+    void push(int index, QVector<ImportLine>& lines);
+
+    bool write(const ImportChunk& chunk);
+    qint64 bufferId(int index, qint64 first_time);
+    qint64 networkId(const QString& network);
+    qint64 senderId(const QString& sender);
+    bool finishBuffers();
+
+    SqliteNative& db;
+    uint userid;
+    int batch_size;
+    int threads;
+    QString network_override;
+    bool force;
+
+    QList<ImportGroup> groups;
+    QHash<QString, int> group_index;
+    int file_count;
+
+    // shared between the workers and the writer
+    QMutex mutex;
+    QWaitCondition queue_not_empty;
+    QWaitCondition queue_not_full;
+    QList<ImportChunk> queue;
+    int running_workers;
+    std::atomic<int> next_group;
+    std::atomic<bool> aborted;
+    std::atomic<qint64> skipped_lines;
+
+    // writer only
+    qint64 time_divisor;
+    QHash<QString, qint64> network_ids;
+    QHash<int, qint64> buffer_ids;
+    QHash<QString, qint64> sender_ids;
+    QList<qint64> created_buffers;
+    QList<qint64> existing_buffers;
+    QSet<qint64> written_buffers;
+    QSet<int> refused_groups;
+    qint64 imported_rows;
+};
+
+#endif // LOGIMPORT_H
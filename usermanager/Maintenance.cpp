@@ -0,0 +1,311 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <iostream>
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QThread>
+
+#include "Maintenance.h"
+#include "BacklogArchive.h"
+#include "GarbageCollector.h"
+
+// a WAL above this size gets a passive checkpoint and counts as core activity
+static const qint64 wal_limit = 64 * 1024 * 1024;
+static const qint64 max_backoff = 5000;
+
+volatile sig_atomic_t MaintenanceRunner::sigint = 0;
+
+MaintenanceRunner::MaintenanceRunner(SqliteNative& database, const QString& file, int size, qint64 budget_msecs, int step_msecs) :
+  db(database), state_file(file), batch_size(size), budget(budget_msecs), step(step_msecs),
+  retention_before(-1), last_acquire(-1), max_step(0), backoff(0), data_version(0),
+  waited_msecs(0), busy_count(0), removed_rows(0), busy_seen(false), stop(false) {
+}
+
+MaintenanceRunner::~MaintenanceRunner() {
+  db.setThrottle(nullptr);
+}
+
+bool MaintenanceRunner::attach() {
+
+  if( !db.attach(state_file, "maintenance") )
+    return false;
+
+  return db.exec("CREATE TABLE IF NOT EXISTS maintenance.maintenance_state ("
+                 "  job TEXT PRIMARY KEY, last_finished INTEGER NOT NULL, batch_size INTEGER NOT NULL)");
+}
+
+void MaintenanceRunner::setRetention(qint64 before, const QString& file) {
+
+  retention_before = before;
+  archive_file = file;
+}
+
+void MaintenanceRunner::onSigint(int) {
+  sigint = 1;
+}
+
+bool MaintenanceRunner::loadState() {
+
+  job_list.clear();
+
+  QStringList names;
+
+  if( retention_before >= 0 )
+    names << "retention";
+
+  names << "gc" << "vacuum";
+
+  SqliteStatement* state = db.statement("SELECT last_finished, batch_size FROM maintenance.maintenance_state WHERE job = ?1");
+
+  if( state == nullptr )
+    return false;
+
+  for( const QString& name : names ) {
+
+    MaintenanceJob job = { name, false, 0, 0, batch_size };
+
+    state->bind(1, name);
+
+    if( state->next() ) {
+      job.last_finished = state->columnInt64(0);
+      job.batch_size = state->columnInt(1);
+    }
+    state->reset();
+
+    job_list.append(job);
+  }
+
+  // the job stopped last time has the oldest finish time and continues first
+  std::stable_sort(job_list.begin(), job_list.end(), [](const MaintenanceJob& a, const MaintenanceJob& b) {
+    return a.last_finished < b.last_finished;
+  });
+
+  return true;
+}
+
+bool MaintenanceRunner::saveState(const MaintenanceJob& job) {
+
+  SqliteStatement* state = db.statement(
+    "INSERT OR REPLACE INTO maintenance.maintenance_state (job, last_finished, batch_size) VALUES (?1, ?2, ?3)");
+
+  if( state == nullptr )
+    return false;
+
+  state->bind(1, job.name);
+  state->bind(2, job.last_finished);
+  state->bind(3, job.batch_size);
+
+  return state->exec();
+}
+
+bool MaintenanceRunner::run() {
+
+  if( !loadState() )
+    return false;
+
+  sigint = 0;
+  stop = false;
+
+  void (*previous_handler)(int) = signal(SIGINT, &MaintenanceRunner::onSigint);
+
+  timer.start();
+  data_version = db.pragma("main.data_version");
+
+  bool success = true;
+
+  for( MaintenanceJob& job : job_list ) {
+
+    if( stop || sigint != 0 )
+      break;
+
+    QElapsedTimer job_timer;
+    job_timer.start();
+
+    last_acquire = -1;
+    max_step = 0;
+
+    db.setThrottle(this);
+    bool finished = runJob(job);
+    db.setThrottle(nullptr);
+
+    job.elapsed = job_timer.elapsed();
+
+    // an error that is no interruption leaves the job in place for the next run
+    if( !finished && !stop && sigint == 0 ) {
+      success = false;
+      break;
+    }
+
+    job.finished = finished;
+
+    if( finished )
+      job.last_finished = QDateTime::currentMSecsSinceEpoch();
+
+    // keep a single step within the step time
+    if( max_step > step )
+      job.batch_size = qMax(100, job.batch_size / 2);
+    else if( finished && max_step < step / 4 )
+      job.batch_size = qMin(batch_size, job.batch_size * 2);
+
+    if( !saveState(job) ) {
+      success = false;
+      break;
+    }
+  }
+
+  if( sigint != 0 )
+    stop = true;
+
+  signal(SIGINT, previous_handler);
+
+  return success;
+}
+
+bool MaintenanceRunner::runJob(MaintenanceJob& job) {
+
+  if( job.name == "retention" ) {
+    BacklogArchive archive(db, archive_file, job.batch_size);
+
+    bool finished = archive.attach() && archive.archive(retention_before);
+    removed_rows += archive.movedRows();
+
+    return finished;
+  }
+
+  if( job.name == "gc" ) {
+    GarbageCollector gc(db, job.batch_size);
+
+    bool finished = gc.run();
+
+    for( auto e : gc.deletedRows() )
+      removed_rows += e.second;
+
+    return finished;
+  }
+
+  return vacuum(job.batch_size);
+}
+
+/**
+ * hand free pages back in steps, without auto_vacuum = INCREMENTAL only a
+ * full VACUUM shrinks the file and that can not be split, so only the WAL
+ * is checkpointed then
+ */
+bool MaintenanceRunner::vacuum(int pages) {
+
+  if( db.pragma("main.auto_vacuum") == 2 ) {
+
+    QByteArray sql = QByteArray("PRAGMA main.incremental_vacuum(") + QByteArray::number(pages) + ")";
+
+    while( db.pragma("main.freelist_count") > 0 ) {
+
+      if( !db.transaction() )
+        return false;
+
+      if( !db.exec(sql.constData()) ) {
+        db.rollback();
+        return false;
+      }
+
+      if( !db.commit() )
+        return false;
+    }
+  }
+
+  return db.exec("PRAGMA main.wal_checkpoint(PASSIVE)");
+}
+
+bool MaintenanceRunner::acquire(SqliteNative& database) {
+
+  if( sigint != 0 || timer.elapsed() >= budget ) {
+    stop = true;
+    return false;
+  }
+
+  if( last_acquire >= 0 ) {
+
+    qint64 step_msecs = timer.elapsed() - last_acquire;
+    max_step = qMax(max_step, step_msecs);
+
+    bool active = busy_seen;
+    qint64 version = database.pragma("main.data_version");
+
+    if( version != data_version ) {
+      data_version = version;
+      active = true;
+    }
+
+    if( QFileInfo(database.fileName() + "-wal").size() > wal_limit ) {
+      database.exec("PRAGMA main.wal_checkpoint(PASSIVE)");
+      active = true;
+    }
+
+    // back off exponentially while the core writes, and recover slowly
+    backoff = active ? qMin(max_backoff, qMax(Q_INT64_C(50), backoff * 2)) : backoff / 2;
+
+    // leave the core at least as much time as the last step took
+    pause(active ? step_msecs + backoff : step_msecs / 4);
+  }
+
+  busy_seen = false;
+
+  if( sigint != 0 || timer.elapsed() >= budget ) {
+    stop = true;
+    return false;
+  }
+
+  last_acquire = timer.elapsed();
+
+  return true;
+}
+
+bool MaintenanceRunner::interrupted() {
+
+  // a step may overrun the budget by one step time at most, the aborted
+  // step is a stop like in acquire() and no error
+  if( sigint != 0 || timer.elapsed() > budget + step ) {
+    stop = true;
+    return true;
+  }
+
+  return false;
+}
+
+void MaintenanceRunner::busy() {
+
+  busy_seen = true;
+  busy_count++;
+}
+
+void MaintenanceRunner::pause(qint64 msecs) {
+
+  msecs = qMin(msecs, budget - timer.elapsed());
+
+  QElapsedTimer slept;
+  slept.start();
+
+  while( sigint == 0 && slept.elapsed() < msecs )
+    QThread::msleep(qMin(Q_INT64_C(50), msecs - slept.elapsed()));
+
+  waited_msecs += slept.elapsed();
+}
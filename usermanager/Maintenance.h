@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include <csignal>
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "SqliteNative.h"
+
+struct MaintenanceJob {
+    QString name;
+    bool finished;
+    qint64 last_finished;
+    qint64 elapsed;
+    int batch_size;
+};
+
+/*
+ * Runs retention, gc and vacuum within a time budget next to a live core.
+ *
+ * The jobs keep their own batches, the runner throttles them between two
+ * write transactions: a commit of the core (data_version), a growing WAL or
+ * a busy lock make it pause for at least the time the last step took. The
+ * budget and SIGINT stop a job between two steps, or inside a step through
+ * the progress handler once it overruns the step time.
+ *
+ * All jobs resume by themselves because finished batches are gone, the
+ * state file only remembers the order (the stopped job goes first) and the
+ * batch size that kept a step within the step time.
+ */
+class MaintenanceRunner : public SqliteThrottle {
+
+public:
+    MaintenanceRunner(SqliteNative& db, const QString& state_file, int batch_size, qint64 budget, int step);
+    ~MaintenanceRunner();
+
+    bool attach();
+    // archive backlog older than before (msecs since epoch) as first job
+    void setRetention(qint64 before, const QString& archive_file);
+
+    // false on errors, a job stopped by budget or SIGINT is no error
+    bool run();
+
+    bool stopped() const { return stop; }
+    bool cancelled() const { return sigint != 0; }
+    QList<MaintenanceJob> jobs() const { return job_list; }
+    qint64 waited() const { return waited_msecs; }
+    int busyCount() const { return busy_count; }
+    // backlog and other rows the retention and gc jobs removed
+    qint64 removedRows() const { return removed_rows; }
+
+    bool acquire(SqliteNative& db) override;
+    bool interrupted() override;
+    void busy() override;
+
+private:
+
+    bool loadState();
+    bool saveState(const MaintenanceJob& job);
+    bool runJob(MaintenanceJob& job);
+    bool vacuum(int pages);
+    void pause(qint64 msecs);
+
+    static void onSigint(int);
+    static volatile sig_atomic_t sigint;
+
+    SqliteNative& db;
+    QString state_file;
+    int batch_size;
+    qint64 budget;
+    int step;
+
+    qint64 retention_before;
+    QString archive_file;
+
+    QElapsedTimer timer;
+    qint64 last_acquire;
+    qint64 max_step;
+    qint64 backoff;
+    qint64 data_version;
+    qint64 waited_msecs;
+    int busy_count;
+    qint64 removed_rows;
+    bool busy_seen;
+    bool stop;
+
+    QList<MaintenanceJob> job_list;
+};
+
+#endif // MAINTENANCE_H
@@ -0,0 +1,457 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <cctype>
+#include <cstring>
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlDriver>
+
+#include "PostgreSqlUser.h"
+
+// escaping of the COPY text format
+static void copyEscape(QByteArray& out, const QByteArray& value) {
+
+  for( char c : value ) {
+    switch( c ) {
+      case '\\': out += "\\\\"; break;
+      case '\t': out += "\\t"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      default: out += c;
+    }
+  }
+}
+
+// \N is NULL, \NNN octal and \xHH hex bytes, any other character stands for itself
+static QString copyUnescape(const char* value, int size) {
+
+  if( size == 2 && value[0] == '\\' && value[1] == 'N' )
+    return QString();
+
+  QByteArray out;
+  out.reserve(size);
+
+  for( int i = 0; i < size; i++ ) {
+
+    if( value[i] != '\\' || i + 1 == size ) {
+      out += value[i];
+      continue;
+    }
+
+    char c = value[++i];
+
+    if( c >= '0' && c <= '7' ) {
+      int byte = c - '0';
+
+      for( int n = 1; n < 3 && i + 1 < size && value[i + 1] >= '0' && value[i + 1] <= '7'; n++ )
+        byte = byte * 8 + ( value[++i] - '0' );
+
+      out += char(byte);
+      continue;
+    }
+
+    if( c == 'x' && i + 1 < size && isxdigit(static_cast<unsigned char>(value[i + 1])) ) {
+      int byte = 0;
+
+      for( int n = 0; n < 2 && i + 1 < size && isxdigit(static_cast<unsigned char>(value[i + 1])); n++ ) {
+        char h = value[++i];
+        byte = byte * 16 + ( h <= '9' ? h - '0' : ( h | 0x20 ) - 'a' + 10 );
+      }
+
+      out += char(byte);
+      continue;
+    }
+
+    switch( c ) {
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'v': out += '\v'; break;
+      default: out += c;
+    }
+  }
+
+  return QString::fromUtf8(out);
+}
+
+PostgreSqlUser::PostgreSqlUser(const QVariantMap& properties) :
+  QuasselUser(QString()) {
+
+  hostname = properties.value("Hostname", "localhost").toString();
+  port = properties.value("Port", 5432).toInt();
+  username = properties.value("Username", "quassel").toString();
+  db_password = properties.value("Password").toString();
+  database = properties.value("Database", "quassel").toString();
+}
+
+QString PostgreSqlUser::backendId() const {
+  return QString("PostgreSQL");
+}
+
+QString PostgreSqlUser::description() const {
+  return ("PostgreSQL Turbo Bomber HD!");
+}
+
+SqliteNative* PostgreSqlUser::nativeDb() {
+
+  std::cerr
+    << std::endl
+    << "ERROR: "
+    << "this operation is only available for the SQLite storage backend"
+    << std::endl;
+
+  return nullptr;
+}
+
+PGconn* PostgreSqlUser::connection(QSqlDatabase& db) {
+
+  QVariant handle = db.driver()->handle();
+
+  if( handle.isValid() && qstrcmp(handle.typeName(), "PGconn*") == 0 )
+    return *static_cast<PGconn**>(handle.data());
+
+  std::cerr
+    << std::endl
+    << "ERROR: "
+    << "Unable to access the libpq connection of the QPSQL driver"
+    << std::endl;
+
+  return nullptr;
+}
+
+bool PostgreSqlUser::exec(PGconn* conn, const char* sql, ExecStatusType expected) {
+
+  PGresult* result = PQexec(conn, sql);
+  bool success = ( PQresultStatus(result) == expected );
+
+  if( !success ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << sql
+      << std::endl
+      << "-"
+      << PQerrorMessage(conn)
+      << std::endl;
+  }
+
+  PQclear(result);
+
+  return success;
+}
+
+uint PostgreSqlUser::addUser(const QString& user, const QString& password, const QString& authenticator) {
+
+  QSqlDatabase db = logDb();
+  uint uid = 0;
+
+  db.transaction();
+
+  QSqlQuery query(db);
+  query.prepare("INSERT INTO quasseluser (username, password, hashversion, authenticator) VALUES (:username, :password, :hashversion, :authenticator) RETURNING userid");
+  query.bindValue(":username", user);
+  query.bindValue(":password", hashPasswordSha2_512(password));
+  query.bindValue(":hashversion", HashVersion::Latest);
+  query.bindValue(":authenticator", authenticator);
+  query.exec();
+
+  // 23505 is unique_violation
+  if( query.lastError().isValid() ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "The User "
+      << user.toStdString()
+      << ( query.lastError().nativeErrorCode() == "23505" ? " already exists" : " could not be added" )
+      << std::endl;
+
+    db.rollback();
+  }
+  else {
+    if( query.first() )
+      uid = query.value(0).toUInt();
+    db.commit();
+  }
+
+  return uid;
+}
+
+/**
+ * COPY the hashed users into a temp table and move them over in one
+ * statement, users that already exist are skipped
+ */
+int PostgreSqlUser::addUsers(const QList<QPair<QString, QString> >& users, const QString& authenticator) {
+
+  QSqlDatabase db = logDb();
+  PGconn* conn = connection(db);
+
+  if( conn == nullptr )
+    return 0;
+
+  db.transaction();
+
+  if( !exec(conn, "CREATE TEMP TABLE IF NOT EXISTS quasseluser_import (username TEXT, password TEXT, hashversion INTEGER, authenticator TEXT) ON COMMIT DELETE ROWS") ||
+      !exec(conn, "COPY quasseluser_import (username, password, hashversion, authenticator) FROM STDIN", PGRES_COPY_IN) ) {
+    db.rollback();
+    return 0;
+  }
+
+  QByteArray auth;
+  copyEscape(auth, authenticator.toUtf8());
+
+  QByteArray version = QByteArray::number(int(HashVersion::Latest));
+  QByteArray buffer;
+  bool success = true;
+
+  for( const auto& user : users ) {
+
+    copyEscape(buffer, user.first.toUtf8());
+    buffer += '\t';
+    buffer += hashPasswordSha2_512(user.second).toUtf8();
+    buffer += '\t';
+    buffer += version;
+    buffer += '\t';
+    buffer += auth;
+    buffer += '\n';
+
+    if( buffer.size() >= 65536 ) {
+      success = success && PQputCopyData(conn, buffer.constData(), buffer.size()) == 1;
+      buffer.clear();
+    }
+  }
+
+  if( !buffer.isEmpty() )
+    success = success && PQputCopyData(conn, buffer.constData(), buffer.size()) == 1;
+
+  PQputCopyEnd(conn, success ? nullptr : "aborted");
+
+  PGresult* result = PQgetResult(conn);
+  success = success && PQresultStatus(result) == PGRES_COMMAND_OK;
+  PQclear(result);
+
+  while( ( result = PQgetResult(conn) ) != nullptr )
+    PQclear(result);
+
+  if( !success ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "COPY into quasseluser_import failed"
+      << std::endl
+      << "-"
+      << PQerrorMessage(conn)
+      << std::endl;
+
+    db.rollback();
+    return 0;
+  }
+
+  result = PQexec(conn,
+    "INSERT INTO quasseluser (username, password, hashversion, authenticator)"
+    "  SELECT username, password, hashversion, authenticator FROM quasseluser_import"
+    "  ON CONFLICT (username) DO NOTHING");
+
+  int added = 0;
+
+  if( PQresultStatus(result) == PGRES_COMMAND_OK ) {
+    added = QByteArray(PQcmdTuples(result)).toInt();
+  } else {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to add the users"
+      << std::endl
+      << "-"
+      << PQerrorMessage(conn)
+      << std::endl;
+  }
+
+  PQclear(result);
+
+  if( added == 0 ) {
+    db.rollback();
+    return 0;
+  }
+
+  if( added != users.size() ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << users.size() - added
+      << " of the users already exist"
+      << std::endl;
+  }
+
+  db.commit();
+
+  return added;
+}
+
+/**
+ * the statements of a batch share one array parameter and are sent in
+ * pipeline mode, so the whole batch costs a single round trip
+ */
+int PostgreSqlUser::deleteUsers(const QList<uint>& users) {
+
+  if( users.isEmpty() )
+    return 0;
+
+  static const char* const statements[] = {
+    "DELETE FROM backlog WHERE bufferid IN (SELECT bufferid FROM buffer WHERE userid = ANY($1::integer[]))",
+    "DELETE FROM buffer WHERE userid = ANY($1::integer[])",
+    "DELETE FROM network WHERE userid = ANY($1::integer[])",
+    "DELETE FROM quasseluser WHERE userid = ANY($1::integer[])",
+    nullptr
+  };
+
+  QSqlDatabase db = logDb();
+  PGconn* conn = connection(db);
+
+  if( conn == nullptr )
+    return 0;
+
+  QByteArray ids = "{";
+
+  for( uint userid : users ) {
+    if( ids.size() > 1 )
+      ids += ',';
+    ids += QByteArray::number(qint64(userid));
+  }
+  ids += '}';
+
+  const char* values[] = { ids.constData() };
+  bool success = true;
+  int deleted = 0;
+
+  db.transaction();
+
+#ifdef LIBPQ_HAS_PIPELINING
+  success = ( PQenterPipelineMode(conn) == 1 );
+
+  for( int i = 0; success && statements[i] != nullptr; i++ )
+    success = ( PQsendQueryParams(conn, statements[i], 1, nullptr, values, nullptr, nullptr, 0) == 1 );
+
+  bool synced = success && ( PQpipelineSync(conn) == 1 );
+  int results = 0;
+
+  // one result (followed by nullptr) per statement, then the sync
+  while( synced ) {
+    PGresult* result = PQgetResult(conn);
+
+    if( result == nullptr ) {
+      if( PQstatus(conn) == CONNECTION_BAD || ++results > 4 )
+        break;
+      continue;
+    }
+
+    ExecStatusType status = PQresultStatus(result);
+
+    if( status == PGRES_PIPELINE_SYNC ) {
+      PQclear(result);
+      break;
+    }
+
+    if( status == PGRES_COMMAND_OK )
+      deleted = QByteArray(PQcmdTuples(result)).toInt();
+    else
+      success = false;
+
+    PQclear(result);
+  }
+
+  success = success && synced;
+  PQexitPipelineMode(conn);
+#else
+  for( int i = 0; success && statements[i] != nullptr; i++ ) {
+    PGresult* result = PQexecParams(conn, statements[i], 1, nullptr, values, nullptr, nullptr, 0);
+    success = ( PQresultStatus(result) == PGRES_COMMAND_OK );
+    deleted = QByteArray(PQcmdTuples(result)).toInt();
+    PQclear(result);
+  }
+#endif
+
+  if( !success ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to delete the users"
+      << std::endl
+      << "-"
+      << PQerrorMessage(conn)
+      << std::endl;
+
+    db.rollback();
+    return 0;
+  }
+
+  db.commit();
+
+  return deleted;
+}
+
+bool PostgreSqlUser::exportUsers(std::ostream& out) {
+
+  QSqlDatabase db = logDb();
+  PGconn* conn = connection(db);
+
+  if( conn == nullptr )
+    return false;
+
+  if( !exec(conn, "COPY (SELECT userid, username, authenticator FROM quasseluser ORDER BY userid) TO STDOUT", PGRES_COPY_OUT) )
+    return false;
+
+  char* line = nullptr;
+  int size = 0;
+
+  while( ( size = PQgetCopyData(conn, &line, 0) ) > 0 ) {
+
+    // userid \t username \t authenticator \n
+    const char* first = static_cast<const char*>(memchr(line, '\t', size));
+    const char* second = first ? static_cast<const char*>(memchr(first + 1, '\t', size - ( first + 1 - line ))) : nullptr;
+
+    if( second != nullptr ) {
+      int end = size - ( line[size - 1] == '\n' ? 1 : 0 );
+
+      QJsonObject json;
+      json.insert("userid", QByteArray(line, first - line).toInt());
+      json.insert("username", copyUnescape(first + 1, second - first - 1));
+      json.insert("authenticator", copyUnescape(second + 1, end - ( second + 1 - line )));
+
+      out << QJsonDocument(json).toJson(QJsonDocument::Compact).constData() << "\n";
+    }
+
+    PQfreemem(line);
+  }
+
+  PGresult* result = PQgetResult(conn);
+  bool success = ( size == -1 && PQresultStatus(result) == PGRES_COMMAND_OK );
+  PQclear(result);
+
+  while( ( result = PQgetResult(conn) ) != nullptr )
+    PQclear(result);
+
+  out.flush();
+
+  return success && out.good();
+}
@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef POSTGRESQLUSER_H
+#define POSTGRESQLUSER_H
+
+#include <libpq-fe.h>
+
+#include <QVariantMap>
+
+#include "QuasselUser.h"
+
+/*
+ * QuasselUser for cores with the PostgreSQL storage backend.
+ *
+ * The connection is configured from the ConnectionProperties of the core's
+ * Core/StorageSettings. Single user operations go through QtSql (QPSQL),
+ * the bulk operations use the libpq connection underneath it for COPY and
+ * for sending a whole batch of statements in one round trip.
+ */
+class PostgreSqlUser : public QuasselUser {
+
+public:
+    PostgreSqlUser(const QVariantMap& properties);
+
+    QString backendId() const override;
+    QString description() const override;
+
+    uint addUser(const QString& user, const QString& password, const QString& authenticator = "Database") override;
+    int addUsers(const QList<QPair<QString, QString> >& users, const QString& authenticator = "Database") override;
+    int deleteUsers(const QList<uint>& users) override;
+    bool exportUsers(std::ostream& out) override;
+
+    SqliteNative* nativeDb() override;
+
+protected:
+
+    QString driverName() const override { return "QPSQL"; }
+    QString dbName() const override { return database; }
+    QString dbHostName() const override { return hostname; }
+    int dbPort() const override { return port; }
+    QString dbUserName() const override { return username; }
+    QString dbPassword() const override { return db_password; }
+
+private:
+
+    PGconn* connection(QSqlDatabase& db);
+    bool exec(PGconn* conn, const char* sql, ExecStatusType expected = PGRES_COMMAND_OK);
+
+    QString hostname;
+    int port;
+    QString username;
+    QString db_password;
+    QString database;
+};
+
+#endif // POSTGRESQLUSER_H
@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include "QuasselSchema.h"
+
+static const char* const quassel_schema[] = {
+  "CREATE TABLE quasseluser ("
+  "  userid INTEGER PRIMARY KEY,"
+  "  username TEXT UNIQUE NOT NULL,"
+  "  password TEXT NOT NULL,"
+  "  hashversion INTEGER NOT NULL DEFAULT 0,"
+  "  authenticator TEXT NOT NULL DEFAULT 'Database')",
+
+  "CREATE TABLE sender ("
+  "  senderid INTEGER PRIMARY KEY NOT NULL,"
+  "  sender TEXT NOT NULL,"
+  "  realname TEXT,"
+  "  avatarurl TEXT)",
+  "CREATE UNIQUE INDEX sender_sender_realname_avatarurl_idx ON sender(sender, realname, avatarurl)",
+
+  "CREATE TABLE network ("
+  "  networkid INTEGER PRIMARY KEY,"
+  "  userid INTEGER NOT NULL,"
+  "  networkname TEXT NOT NULL,"
+  "  identityid INTEGER,"
+  "  UNIQUE (userid, networkname))",
+
+  "CREATE TABLE buffer ("
+  "  bufferid INTEGER PRIMARY KEY,"
+  "  userid INTEGER NOT NULL,"
+  "  groupid INTEGER,"
+  "  networkid INTEGER NOT NULL,"
+  "  buffername TEXT NOT NULL,"
+  "  buffercname TEXT NOT NULL,"
+  "  buffertype INTEGER NOT NULL DEFAULT 0,"
+  "  lastmsgid INTEGER NOT NULL DEFAULT 0,"
+  "  lastseenmsgid INTEGER NOT NULL DEFAULT 0,"
+  "  markerlinemsgid INTEGER NOT NULL DEFAULT 0,"
+  "  bufferactivity INTEGER NOT NULL DEFAULT 0,"
+  "  highlightcount INTEGER NOT NULL DEFAULT 0,"
+  "  key TEXT,"
+  "  joined INTEGER NOT NULL DEFAULT 0,"
+  "  cipher TEXT,"
+  "  UNIQUE (userid, networkid, buffercname))",
+  "CREATE INDEX buffer_cname_idx ON buffer(buffercname)",
+
+  "CREATE TABLE backlog ("
+  "  messageid INTEGER PRIMARY KEY,"
+  "  time INTEGER NOT NULL,"
+  "  bufferid INTEGER NOT NULL,"
+  "  type INTEGER NOT NULL,"
+  "  flags INTEGER NOT NULL,"
+  "  senderid INTEGER NOT NULL,"
+  "  senderprefixes TEXT,"
+  "  message TEXT)",
+  "CREATE INDEX backlog_bufferid_idx ON backlog(bufferid, messageid)",
+
+  "CREATE TABLE identity ("
+  "  identityid INTEGER PRIMARY KEY,"
+  "  userid INTEGER NOT NULL,"
+  "  identityname TEXT NOT NULL,"
+  "  realname TEXT NOT NULL DEFAULT '',"
+  "  UNIQUE (userid, identityname))",
+
+  "CREATE TABLE identity_nick ("
+  "  nickid INTEGER PRIMARY KEY,"
+  "  identityid INTEGER NOT NULL,"
+  "  nick TEXT NOT NULL,"
+  "  UNIQUE (identityid, nick))",
+
+  "CREATE TABLE ircserver ("
+  "  serverid INTEGER PRIMARY KEY,"
+  "  userid INTEGER NOT NULL,"
+  "  networkid INTEGER NOT NULL,"
+  "  hostname TEXT NOT NULL,"
+  "  port INTEGER NOT NULL DEFAULT 6667)",
+
+  "CREATE TABLE user_setting ("
+  "  userid INTEGER NOT NULL,"
+  "  settingname TEXT NOT NULL,"
+  "  settingvalue BLOB,"
+  "  PRIMARY KEY (userid, settingname))",
+
+  "CREATE TABLE coresession ("
+  "  userid INTEGER PRIMARY KEY,"
+  "  sessiondata BLOB)",
+
+  nullptr
+};
+
+bool createQuasselSchema(SqliteNative& db) {
+
+  if( !db.transaction() )
+    return false;
+
+  for( int i = 0; quassel_schema[i] != nullptr; i++ ) {
+
+    if( !db.exec(quassel_schema[i]) ) {
+      db.rollback();
+      return false;
+    }
+  }
+
+  return db.commit();
+}
+
+qint64 backlogTimeDivisor(SqliteNative& db) {
+
+  SqliteStatement* query = db.statement("SELECT time FROM main.backlog ORDER BY messageid DESC LIMIT 1");
+
+  if( query == nullptr )
+    return 1;
+
+  // 10^11 is 1973 in msecs and the year 5138 in secs
+  qint64 divisor = ( query->next() && query->columnInt64(0) < Q_INT64_C(100000000000) ) ? 1000 : 1;
+  query->reset();
+
+  return divisor;
+}
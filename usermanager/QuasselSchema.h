@@ -0,0 +1,39 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef QUASSELSCHEMA_H
+#define QUASSELSCHEMA_H
+
+#include "SqliteNative.h"
+
+/*
+ * Creates the tables of the quassel core SQLite storage (the columns this
+ * tool touches, with the core's primary keys and indexes) in an empty
+ * database. Used for scratch databases of the benchmark and simulator modes.
+ */
+bool createQuasselSchema(SqliteNative& db);
+
+/*
+ * backlog.time holds seconds in schemas before 0.13 and msecs since then,
+ * returns what msecs since epoch have to be divided by (1 for an empty backlog)
+ */
+qint64 backlogTimeDivisor(SqliteNative& db);
+
+#endif // QUASSELSCHEMA_H
@@ -18,16 +18,20 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
  ***************************************************************************/
 
+#include <QJsonDocument>
+#include <QJsonObject>
+
 #include "QuasselUser.h"
 
-QuasselUser::QuasselUser(const QString& file){
+QuasselUser::QuasselUser(const QString& file) :
+  native_backend(false) {
 
   database_file = file;
 }
 
 bool QuasselUser::isAvailable() const {
 
-  if (!QSqlDatabase::isDriverAvailable("QSQLITE"))
+  if (!QSqlDatabase::isDriverAvailable(driverName()))
     return false;
   return true;
 }
@@ -57,8 +61,19 @@ QSqlDatabase QuasselUser::logDb() {
   if(QSqlDatabase::contains(QSqlDatabase::defaultConnection)) {
     db = QSqlDatabase::database();
   } else {
-    db = QSqlDatabase::addDatabase("QSQLITE");
-    db.setDatabaseName(database_file);
+    db = QSqlDatabase::addDatabase(driverName());
+    db.setDatabaseName(dbName());
+
+    if( !dbHostName().isEmpty() )
+      db.setHostName(dbHostName());
+
+    if( dbPort() > 0 )
+      db.setPort(dbPort());
+
+    if( !dbUserName().isEmpty() ) {
+      db.setUserName(dbUserName());
+      db.setPassword(dbPassword());
+    }
   }
 
   if( !db.isOpen() ) {
@@ -76,13 +91,24 @@ void QuasselUser::dbConnect(QSqlDatabase& db) {
       << "ERROR: "
       << "Unable to open database" << displayName().toStdString()
       << "file "
-      << database_file.toStdString()
+      << dbName().toStdString()
       << std::endl
       << "-"
       << db.lastError().text().toStdString();
   }
 }
 
+SqliteNative* QuasselUser::nativeDb() {
+
+  if( native_db.isNull() )
+    native_db.reset(new SqliteNative(database_file));
+
+  if( !native_db->open() )
+    return nullptr;
+
+  return native_db.data();
+}
+
 uint QuasselUser::addUser(const QString& user, const QString& password, const QString& authenticator) {
 
   QSqlDatabase db = logDb();
@@ -119,6 +145,105 @@ uint QuasselUser::addUser(const QString& user, const QString& password, const QS
   return uid;
 }
 
+int QuasselUser::addUsers(const QList<QPair<QString, QString> >& users, const QString& authenticator) {
+
+  QList<QPair<QString, QString> > hashed;
+  hashed.reserve(users.size());
+
+  for( const auto& user : users )
+    hashed.append(qMakePair(user.first, hashPasswordSha2_512(user.second)));
+
+  return addHashedUsers(hashed, authenticator);
+}
+
+int QuasselUser::addHashedUsers(const QList<QPair<QString, QString> >& users, const QString& authenticator) {
+
+  if( native_backend )
+    return addUsersNative(users, authenticator);
+
+  QSqlDatabase db = logDb();
+  int added = 0;
+
+  db.transaction();
+
+  QSqlQuery query(db);
+  query.prepare("INSERT INTO quasseluser (username, password, hashversion, authenticator) VALUES (:username, :password, :hashversion, :authenticator)");
+
+  for( const auto& user : users ) {
+
+    query.bindValue(":username", user.first);
+    query.bindValue(":password", user.second);
+    query.bindValue(":hashversion", HashVersion::Latest);
+    query.bindValue(":authenticator", authenticator);
+    query.exec();
+
+    if( query.lastError().isValid() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "The User "
+        << user.first.toStdString()
+        << " could not be added"
+        << std::endl
+        << "-"
+        << query.lastError().text().toStdString()
+        << std::endl;
+    } else {
+      added++;
+    }
+  }
+
+  db.commit();
+
+  return added;
+}
+
+int QuasselUser::addUsersNative(const QList<QPair<QString, QString> >& users, const QString& authenticator) {
+
+  SqliteNative* db = nativeDb();
+
+  if( db == nullptr || !db->transaction() )
+    return 0;
+
+  SqliteStatement* query = db->statement("INSERT INTO quasseluser (username, password, hashversion, authenticator) VALUES (?1, ?2, ?3, ?4)");
+
+  if( query == nullptr ) {
+    db->rollback();
+    return 0;
+  }
+
+  QByteArray auth = authenticator.toUtf8();
+  int added = 0;
+
+  for( const auto& user : users ) {
+
+    query->bind(1, user.first);
+    query->bind(2, user.second);
+    query->bind(3, int(HashVersion::Latest));
+    query->bind(4, auth);
+
+    if( !query->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "The User "
+        << user.first.toStdString()
+        << " could not be added"
+        << std::endl
+        << "-"
+        << db->lastError().toStdString()
+        << std::endl;
+    } else {
+      added++;
+    }
+  }
+
+  query->reset();
+  db->commit();
+
+  return added;
+}
+
 bool QuasselUser::updateUser(uint user, const QString& password) {
 
   QSqlDatabase db = logDb();
@@ -174,8 +299,29 @@ void QuasselUser::renameUser(const QString& username, const QString& newName) {
     renameUser(user_id, newName);
 }
 
+bool QuasselUser::setCredentialIndex(bool enabled) {
+
+  credential_index.reset();
+
+  // data_version only exists for sqlite
+  if( !enabled || driverName() != "QSQLITE" )
+    return !enabled;
+
+  credential_index.reset(new CredentialIndex(database_file));
+
+  if( !credential_index->load() ) {
+    credential_index.reset();
+    return false;
+  }
+
+  return true;
+}
+
 uint QuasselUser::validateUser(const QString& user, const QString& password) {
 
+  if( !credential_index.isNull() )
+    return credential_index->validate(user, password);
+
   uint userId = 0;
   QString hashedPassword;
 
@@ -228,7 +374,7 @@ QString QuasselUser::getUserAuthenticator(uint userid) {
   return authenticator;
 }
 
-void QuasselUser::deleteUser(uint user) {
+int QuasselUser::deleteUser(uint user) {
 
   QSqlDatabase db = logDb();
   db.transaction();
@@ -238,6 +384,8 @@ void QuasselUser::deleteUser(uint user) {
   query.bindValue(":userid", user);
   query.exec();
 
+  int lines = query.numRowsAffected();
+
   query.prepare("DELETE FROM buffer WHERE userid = :userid");
   query.bindValue(":userid", user);
   query.exec();
@@ -252,18 +400,109 @@ void QuasselUser::deleteUser(uint user) {
 
   // I hate the lack of foreign keys and on delete cascade... :(
   db.commit();
+
+  return qMax(lines, 0);
 }
 
-void QuasselUser::deleteUser(const QString& username) {
+int QuasselUser::deleteUser(const QString& username) {
 
   uint user_id = getUserId(username);
 
-  if( user_id != 0 )
-    deleteUser(user_id);
+  if( user_id == 0 )
+    return 0;
+
+  return deleteUser(user_id);
+}
+
+int QuasselUser::updateUsers(const QList<QPair<uint, QString> >& passwords) {
+
+  QSqlDatabase db = logDb();
+  int updated = 0;
+
+  db.transaction();
+
+  QSqlQuery query(db);
+  query.prepare("UPDATE quasseluser SET password = :password, hashversion = :hashversion WHERE userid = :userid");
+
+  for( const auto& user : passwords ) {
+
+    query.bindValue(":userid", user.first);
+    query.bindValue(":password", hashPasswordSha2_512(user.second));
+    query.bindValue(":hashversion", HashVersion::Latest);
+    query.exec();
+
+    updated += query.numRowsAffected();
+  }
+
+  db.commit();
+
+  return updated;
+}
+
+int QuasselUser::setUserAuthenticators(const QList<QPair<uint, QString> >& authenticators) {
+
+  QSqlDatabase db = logDb();
+  int updated = 0;
+
+  db.transaction();
+
+  QSqlQuery query(db);
+  query.prepare("UPDATE quasseluser SET authenticator = :authenticator WHERE userid = :userid");
+
+  for( const auto& user : authenticators ) {
+
+    query.bindValue(":userid", user.first);
+    query.bindValue(":authenticator", user.second);
+    query.exec();
+
+    updated += query.numRowsAffected();
+  }
+
+  db.commit();
+
+  return updated;
+}
+
+int QuasselUser::deleteUsers(const QList<uint>& users) {
+
+  QSqlDatabase db = logDb();
+  int deleted = 0;
+
+  db.transaction();
+
+  QSqlQuery backlog(db);
+  backlog.prepare("DELETE FROM backlog WHERE bufferid IN (SELECT DISTINCT bufferid FROM buffer WHERE userid = :userid)");
+  QSqlQuery buffer(db);
+  buffer.prepare("DELETE FROM buffer WHERE userid = :userid");
+  QSqlQuery network(db);
+  network.prepare("DELETE FROM network WHERE userid = :userid");
+  QSqlQuery user(db);
+  user.prepare("DELETE FROM quasseluser WHERE userid = :userid");
+
+  for( uint userid : users ) {
+
+    backlog.bindValue(":userid", userid);
+    backlog.exec();
+    buffer.bindValue(":userid", userid);
+    buffer.exec();
+    network.bindValue(":userid", userid);
+    network.exec();
+    user.bindValue(":userid", userid);
+    user.exec();
+
+    deleted += user.numRowsAffected();
+  }
+
+  db.commit();
+
+  return deleted;
 }
 
 QMap<uint, QString> QuasselUser::getAllAuthUserNames() {
 
+  if( native_backend )
+    return getAllAuthUserNamesNative();
+
   QMap<uint, QString> authusernames;
 
   QSqlDatabase db = logDb();
@@ -282,6 +521,100 @@ QMap<uint, QString> QuasselUser::getAllAuthUserNames() {
   return authusernames;
 }
 
+QMap<uint, QString> QuasselUser::getAllAuthUserNamesNative() {
+
+  QMap<uint, QString> authusernames;
+
+  SqliteNative* db = nativeDb();
+
+  if( db == nullptr )
+    return authusernames;
+
+  SqliteStatement* query = db->statement("SELECT userid, username FROM quasseluser");
+
+  if( query == nullptr )
+    return authusernames;
+
+  while( query->next() ) {
+    authusernames.insert(uint(query->columnInt64(0)), query->columnText(1));
+  }
+
+  query->reset();
+
+  return authusernames;
+}
+
+QList<QuasselUserRecord> QuasselUser::getAllUsers() {
+
+  if( native_backend )
+    return getAllUsersNative();
+
+  QList<QuasselUserRecord> users;
+
+  QSqlQuery query(logDb());
+  query.setForwardOnly(true);
+  query.prepare("SELECT userid, username, password, hashversion, authenticator FROM quasseluser");
+  query.exec();
+
+  while( query.next() ) {
+    QuasselUserRecord user;
+    user.userid = query.value(0).toUInt();
+    user.username = query.value(1).toString();
+    user.password = query.value(2).toString();
+    user.hashversion = query.value(3).toInt();
+    user.authenticator = query.value(4).toString();
+    users.append(user);
+  }
+
+  return users;
+}
+
+bool QuasselUser::exportUsers(std::ostream& out) {
+
+  for( const QuasselUserRecord& user : getAllUsers() ) {
+
+    QJsonObject json;
+    json.insert("userid", int(user.userid));
+    json.insert("username", user.username);
+    json.insert("authenticator", user.authenticator);
+
+    out << QJsonDocument(json).toJson(QJsonDocument::Compact).constData() << "\n";
+  }
+
+  out.flush();
+
+  return out.good();
+}
+
+QList<QuasselUserRecord> QuasselUser::getAllUsersNative() {
+
+  QList<QuasselUserRecord> users;
+
+  SqliteNative* db = nativeDb();
+
+  if( db == nullptr )
+    return users;
+
+  SqliteStatement* query = db->statement("SELECT userid, username, password, hashversion, authenticator FROM quasseluser");
+
+  if( query == nullptr )
+    return users;
+
+  while( query->next() ) {
+    QuasselUserRecord user;
+    user.userid = uint(query->columnInt64(0));
+    user.username = query->columnText(1);
+    user.password = query->columnText(2);
+    user.hashversion = query->columnInt(3);
+    user.authenticator = query->columnText(4);
+    users.append(user);
+  }
+
+  query->reset();
+
+  return users;
+}
+
 bool QuasselUser::checkHashedPassword(const QString& password, const QString& hashedPassword) {
 
   QRegExp colonSplitter("\\:");
@@ -296,6 +629,15 @@ bool QuasselUser::checkHashedPassword(const QString& password, const QString& ha
   }
 }
 
+bool QuasselUser::checkHashedPassword(const QString& password, const QString& hashedPassword, int hashversion) {
+
+  // the core stores sha1 as a plain hex digest without salt
+  if( hashversion == HashVersion::Sha1 )
+    return QString(QCryptographicHash::hash(password.toUtf8(), QCryptographicHash::Sha1).toHex()) == hashedPassword;
+
+  return checkHashedPassword(password, hashedPassword);
+}
+
 QString QuasselUser::hashPasswordSha2_512(const QString& password) {
 
     // Generate a salt of 512 bits (64 bytes) using the Mersenne Twister
@@ -18,27 +18,46 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
  ***************************************************************************/
 
+#ifndef QUASSELUSER_H
+#define QUASSELUSER_H
+
 #include <iostream>
 
 #include <QSqlDatabase>
 #include <QVariantList>
 #include <QtSql>
 
+#include "CredentialIndex.h"
+#include "SqliteNative.h"
+
+struct QuasselUserRecord {
+    uint userid;
+    QString username;
+    QString password;
+    int hashversion;
+    QString authenticator;
+};
+
 class QuasselUser {
 
 public:
     QuasselUser(const QString& database_file);
+    virtual ~QuasselUser() {}
 
-    bool isAvailable() const ;
-    QString backendId() const ;
+    virtual bool isAvailable() const ;
+    virtual QString backendId() const ;
     QString displayName() const ;
     QVariantList setupData() const  { return {}; }
-    QString description() const ;
+    virtual QString description() const ;
 
     // TODO: Add functions for configuring the backlog handling, i.e. defining auto-cleanup settings etc
 
     /* User handling */
-    uint addUser(const QString& user, const QString& password, const QString& authenticator = "Database") ;
+    virtual uint addUser(const QString& user, const QString& password, const QString& authenticator = "Database") ;
+    virtual int addUsers(const QList<QPair<QString, QString> >& users, const QString& authenticator = "Database");
+    /* Inserts (username, password hash) pairs, the insert path of addUsers without the hashing */
+    int addHashedUsers(const QList<QPair<QString, QString> >& users, const QString& authenticator = "Database");
+    QString hashPasswordSha2_512(const QString& password);
 
     bool updateUser(uint user, const QString& password) ;
     bool updateUser(const QString& username, const QString& password);
@@ -50,13 +69,35 @@ public:
 
     uint getUserId(const QString& username) ;
 
-    void deleteUser(uint user);
-    void deleteUser(const QString& user);
+    /* returns the number of deleted backlog lines */
+    int deleteUser(uint user);
+    int deleteUser(const QString& user);
+
+    /* Bulk user handling, every call is a single transaction */
+    int updateUsers(const QList<QPair<uint, QString> >& passwords);
+    int setUserAuthenticators(const QList<QPair<uint, QString> >& authenticators);
+    virtual int deleteUsers(const QList<uint>& users);
 
     QString getUserAuthenticator(uint userid);
 
     // Sysident handling
     QMap<uint, QString> getAllAuthUserNames() ;
+    QList<QuasselUserRecord> getAllUsers();
+    virtual bool exportUsers(std::ostream& out);
+
+    bool checkHashedPassword(const QString& password, const QString& hashedPassword);
+    // also understands legacy sha1 hashes
+    bool checkHashedPassword(const QString& password, const QString& hashedPassword, int hashversion);
+
+    /* Native sqlite3 connection for the bulk paths (list, batch add, ...) */
+    void setNativeBackend(bool enabled) { native_backend = enabled; }
+    bool nativeBackend() const { return native_backend; }
+    virtual SqliteNative* nativeDb();
+
+    QString databaseFile() const { return database_file; }
+
+    /* In-memory credential index for validateUser, sqlite only */
+    bool setCredentialIndex(bool enabled);
 
 protected:
 
@@ -64,17 +105,32 @@ protected:
     void dbConnect(QSqlDatabase& db);
     bool initDbSession(QSqlDatabase& /* db */) { return true; }
 
-    bool checkHashedPassword(const QString& password, const QString& hashedPassword);
-
-private:
-
-    QString database_file;
-    QString hashPasswordSha2_512(const QString& password);
-    QString sha2_512(const QString& input);
+    /* Connection properties of the storage backend */
+    virtual QString driverName() const { return "QSQLITE"; }
+    virtual QString dbName() const { return database_file; }
+    virtual QString dbHostName() const { return QString(); }
+    virtual int dbPort() const { return -1; }
+    virtual QString dbUserName() const { return QString(); }
+    virtual QString dbPassword() const { return QString(); }
 
     enum HashVersion {
       Sha1,
       Sha2_512,
       Latest = Sha2_512
     };
+
+private:
+
+    QString database_file;
+    bool native_backend;
+    QScopedPointer<SqliteNative> native_db;
+    QScopedPointer<CredentialIndex> credential_index;
+
+    int addUsersNative(const QList<QPair<QString, QString> >& users, const QString& authenticator);
+    QMap<uint, QString> getAllAuthUserNamesNative();
+    QList<QuasselUserRecord> getAllUsersNative();
+
+    QString sha2_512(const QString& input);
 };
+
+#endif // QUASSELUSER_H
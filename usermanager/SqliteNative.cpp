@@ -0,0 +1,445 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include <QFile>
+
+#include "SqliteNative.h"
+
+SqliteStatement::SqliteStatement(sqlite3* database, const char* sql) :
+  db(database), stmt(nullptr), result(SQLITE_OK) {
+
+  result = sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr);
+
+  if( result != SQLITE_OK ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to prepare statement: "
+      << sql
+      << std::endl
+      << "-"
+      << sqlite3_errmsg(db)
+      << std::endl;
+
+    stmt = nullptr;
+  }
+}
+
+SqliteStatement::~SqliteStatement() {
+
+  if( stmt != nullptr )
+    sqlite3_finalize(stmt);
+}
+
+void SqliteStatement::bind(int index, int value) {
+  sqlite3_bind_int(stmt, index, value);
+}
+
+void SqliteStatement::bind(int index, qint64 value) {
+  sqlite3_bind_int64(stmt, index, value);
+}
+
+void SqliteStatement::bind(int index, const QByteArray& utf8) {
+  sqlite3_bind_text(stmt, index, utf8.constData(), utf8.size(), SQLITE_TRANSIENT);
+}
+
+void SqliteStatement::bind(int index, const QString& value) {
+  bind(index, value.toUtf8());
+}
+
+void SqliteStatement::bindNull(int index) {
+  sqlite3_bind_null(stmt, index);
+}
+
+bool SqliteStatement::next() {
+
+  if( stmt == nullptr )
+    return false;
+
+  result = sqlite3_step(stmt);
+
+  return result == SQLITE_ROW;
+}
+
+bool SqliteStatement::exec() {
+
+  if( stmt == nullptr )
+    return false;
+
+  do {
+    result = sqlite3_step(stmt);
+  } while( result == SQLITE_ROW );
+
+  // sqlite3_reset() would overwrite the error of the last step
+  int step_result = result;
+  sqlite3_reset(stmt);
+  result = step_result;
+
+  return result == SQLITE_DONE;
+}
+
+void SqliteStatement::reset() {
+
+  if( stmt == nullptr )
+    return;
+
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  result = SQLITE_OK;
+}
+
+int SqliteStatement::parameterCount() const {
+  return stmt != nullptr ? sqlite3_bind_parameter_count(stmt) : 0;
+}
+
+int SqliteStatement::columnInt(int column) const {
+  return sqlite3_column_int(stmt, column);
+}
+
+qint64 SqliteStatement::columnInt64(int column) const {
+  return sqlite3_column_int64(stmt, column);
+}
+
+QString SqliteStatement::columnText(int column) const {
+
+  const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+  int size = sqlite3_column_bytes(stmt, column);
+
+  return QString::fromUtf8(text, size);
+}
+
+QByteArray SqliteStatement::columnBlob(int column) const {
+
+  const char* data = static_cast<const char*>(sqlite3_column_blob(stmt, column));
+  int size = sqlite3_column_bytes(stmt, column);
+
+  return QByteArray(data, size);
+}
+
+bool SqliteStatement::columnIsNull(int column) const {
+  return sqlite3_column_type(stmt, column) == SQLITE_NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+SqliteNative::SqliteNative(const QString& file) :
+  database_file(file), db(nullptr), throttle(nullptr), busy_timeout(5000), busy_waited(0), lock_wait(0) {
+}
+
+SqliteNative::~SqliteNative() {
+  close();
+}
+
+bool SqliteNative::open(bool create) {
+
+  if( db != nullptr )
+    return true;
+
+  int flags = SQLITE_OPEN_READWRITE;
+
+  if( create )
+    flags |= SQLITE_OPEN_CREATE;
+
+  int rc = sqlite3_open_v2(database_file.toUtf8().constData(), &db, flags, nullptr);
+
+  if( rc != SQLITE_OK ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to open database file "
+      << database_file.toStdString()
+      << std::endl
+      << "-"
+      << ( db != nullptr ? sqlite3_errmsg(db) : "out of memory" )
+      << std::endl;
+
+    sqlite3_close(db);
+    db = nullptr;
+    return false;
+  }
+
+  // the running core holds the write lock from time to time, wait for it
+  sqlite3_busy_handler(db, &SqliteNative::busyHandler, this);
+
+  return true;
+}
+
+void SqliteNative::close() {
+
+  qDeleteAll(statements);
+  statements.clear();
+
+  if( db != nullptr ) {
+    sqlite3_close(db);
+    db = nullptr;
+  }
+}
+
+SqliteStatement* SqliteNative::statement(const char* sql) {
+
+  if( db == nullptr && !open() )
+    return nullptr;
+
+  QByteArray key(sql);
+  SqliteStatement* stmt = statements.value(key, nullptr);
+
+  if( stmt == nullptr ) {
+    stmt = new SqliteStatement(db, sql);
+
+    if( !stmt->isValid() ) {
+      delete stmt;
+      return nullptr;
+    }
+    statements.insert(key, stmt);
+  } else {
+    stmt->reset();
+  }
+
+  return stmt;
+}
+
+bool SqliteNative::exec(const char* sql) {
+
+  if( db == nullptr && !open() )
+    return false;
+
+  char* error = nullptr;
+
+  if( sqlite3_exec(db, sql, nullptr, nullptr, &error) != SQLITE_OK ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << sql
+      << std::endl
+      << "-"
+      << ( error != nullptr ? error : "unknown error" )
+      << std::endl;
+
+    sqlite3_free(error);
+    return false;
+  }
+
+  return true;
+}
+
+bool SqliteNative::attach(const QString& file, const char* name) {
+
+  // the connection is opened without SQLITE_OPEN_CREATE, so ATTACH can not create the file
+  if( !QFile(file).exists() ) {
+    SqliteNative side(file);
+
+    if( !side.open(true) )
+      return false;
+  }
+
+  QByteArray sql = QByteArray("ATTACH DATABASE ?1 AS ") + name;
+  SqliteStatement* query = statement(sql.constData());
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, file);
+
+  if( !query->exec() ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to attach database file "
+      << file.toStdString()
+      << std::endl
+      << "-"
+      << lastError().toStdString()
+      << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool SqliteNative::hasTable(const char* table) {
+
+  SqliteStatement* query = statement("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?1");
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, QByteArray(table));
+  bool found = query->next();
+  query->reset();
+
+  return found;
+}
+
+qint64 SqliteNative::pragma(const char* name) {
+
+  QByteArray sql = QByteArray("PRAGMA ") + name;
+  SqliteStatement* query = statement(sql.constData());
+
+  if( query == nullptr )
+    return -1;
+
+  qint64 value = query->next() ? query->columnInt64(0) : -1;
+  query->reset();
+
+  return value;
+}
+
+void SqliteNative::setThrottle(SqliteThrottle* t) {
+
+  throttle = t;
+
+  // a throttled job gives way to the core instead of queueing for the lock
+  busy_timeout = ( throttle != nullptr ) ? 250 : 5000;
+
+  if( db == nullptr )
+    return;
+
+  sqlite3_progress_handler(db, throttle != nullptr ? 1000 : 0, throttle != nullptr ? &SqliteNative::progressHandler : nullptr, throttle);
+}
+
+/**
+ * the delays of sqlite3_busy_timeout(), but the waited time is accounted
+ */
+int SqliteNative::busyHandler(void* database, int count) {
+
+  static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+
+  SqliteNative* self = static_cast<SqliteNative*>(database);
+
+  if( count == 0 )
+    self->busy_waited = 0;
+
+  int delay = qMin(delays[qMin(count, 11)], self->busy_timeout - self->busy_waited);
+
+  if( delay <= 0 )
+    return 0;
+
+  int slept = sqlite3_sleep(delay);
+
+  self->busy_waited += slept;
+  self->lock_wait += slept;
+
+  return 1;
+}
+
+int SqliteNative::progressHandler(void* throttle) {
+  return static_cast<SqliteThrottle*>(throttle)->interrupted() ? 1 : 0;
+}
+
+bool SqliteNative::transaction(bool immediate) {
+  // take the write lock up front instead of failing on the first write,
+  // a deferred transaction only locks the databases it actually writes to
+  const char* sql = immediate ? "BEGIN IMMEDIATE" : "BEGIN";
+
+  if( throttle == nullptr )
+    return exec(sql);
+
+  forever {
+
+    if( !throttle->acquire(*this) )
+      return false;
+
+    if( db == nullptr && !open() )
+      return false;
+
+    int rc = sqlite3_exec(db, sql, nullptr, nullptr, nullptr);
+
+    if( rc == SQLITE_OK )
+      return true;
+
+    if( rc != SQLITE_BUSY ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << sql
+        << std::endl
+        << "-"
+        << lastError().toStdString()
+        << std::endl;
+      return false;
+    }
+
+    throttle->busy();
+  }
+}
+
+bool SqliteNative::commit() {
+
+  if( throttle == nullptr )
+    return exec("COMMIT");
+
+  // a COMMIT that is busy (rollback journal, readers on the file) keeps the
+  // transaction open, it is retried until the job is interrupted
+  forever {
+
+    int rc = sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr);
+
+    if( rc == SQLITE_OK )
+      return true;
+
+    if( rc != SQLITE_BUSY ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "COMMIT"
+        << std::endl
+        << "-"
+        << lastError().toStdString()
+        << std::endl;
+
+      rollback();
+      return false;
+    }
+
+    throttle->busy();
+
+    if( throttle->interrupted() ) {
+      rollback();
+      return false;
+    }
+  }
+}
+
+bool SqliteNative::rollback() {
+
+  // an interrupted statement or a failed COMMIT may have rolled back already
+  if( db == nullptr || sqlite3_get_autocommit(db) != 0 )
+    return true;
+
+  return exec("ROLLBACK");
+}
+
+qint64 SqliteNative::lastInsertId() const {
+  return sqlite3_last_insert_rowid(db);
+}
+
+int SqliteNative::numRowsAffected() const {
+  return sqlite3_changes(db);
+}
+
+int SqliteNative::lastErrorCode() const {
+  return sqlite3_errcode(db);
+}
+
+QString SqliteNative::lastError() const {
+  return QString::fromUtf8(sqlite3_errmsg(db));
+}
@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef SQLITENATIVE_H
+#define SQLITENATIVE_H
+
+#include <sqlite3.h>
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+/*
+ * Thin wrapper around a prepared sqlite3 statement.
+ *
+ * Parameters are bound by index (1-based, like sqlite3_bind_*) and columns
+ * are read by index (0-based) straight from the statement, without going
+ * through QVariant.
+ */
+class SqliteStatement {
+
+public:
+    SqliteStatement(sqlite3* db, const char* sql);
+    ~SqliteStatement();
+
+    bool isValid() const { return stmt != nullptr; }
+
+    void bind(int index, int value);
+    void bind(int index, qint64 value);
+    void bind(int index, const QByteArray& utf8);
+    void bind(int index, const QString& value);
+    void bindNull(int index);
+
+    // returns true as long as there is a row to read
+    bool next();
+    // runs the statement to completion and resets it
+    bool exec();
+    // makes the statement reusable and clears all bindings
+    void reset();
+
+    int columnInt(int column) const;
+    qint64 columnInt64(int column) const;
+    QString columnText(int column) const;
+    QByteArray columnBlob(int column) const;
+    bool columnIsNull(int column) const;
+
+    int lastResult() const { return result; }
+    int parameterCount() const;
+
+private:
+    SqliteStatement(const SqliteStatement&) = delete;
+    SqliteStatement& operator=(const SqliteStatement&) = delete;
+
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+    int result;
+};
+
+class SqliteNative;
+
+/*
+ * Lets a long running job share the database with the core.
+ *
+ * acquire() is asked before every write transaction and may wait or stop
+ * the job, interrupted() is polled from the sqlite progress handler while
+ * a statement runs and aborts it with SQLITE_INTERRUPT, and between the
+ * retries of a busy COMMIT.
+ */
+class SqliteThrottle {
+
+public:
+    virtual ~SqliteThrottle() {}
+
+    virtual bool acquire(SqliteNative& db) = 0;
+    virtual bool interrupted() = 0;
+    virtual void busy() = 0;
+};
+
+/*
+ * A native sqlite3 connection for the bulk paths of QuasselUser.
+ *
+ * Statements handed out by statement() are prepared once per connection
+ * and reset before they are returned, so loops only pay for bind and step.
+ */
+class SqliteNative {
+
+public:
+    SqliteNative(const QString& database_file);
+    ~SqliteNative();
+
+    bool open(bool create = false);
+    bool isOpen() const { return db != nullptr; }
+    void close();
+
+    sqlite3* handle() const { return db; }
+    QString fileName() const { return database_file; }
+
+    // nullptr restores the plain blocking behaviour
+    void setThrottle(SqliteThrottle* throttle);
+
+    // msecs spent waiting for locks held by other connections
+    qint64 lockWait() const { return lock_wait; }
+
+    SqliteStatement* statement(const char* sql);
+    bool exec(const char* sql);
+
+    // attaches (and creates) a side database of this tool under the given schema name
+    bool attach(const QString& file, const char* name);
+
+    bool hasTable(const char* table);
+    qint64 pragma(const char* name);
+
+    bool transaction(bool immediate = true);
+    bool commit();
+    bool rollback();
+
+    qint64 lastInsertId() const;
+    int numRowsAffected() const;
+    int lastErrorCode() const;
+    QString lastError() const;
+
+private:
+    SqliteNative(const SqliteNative&) = delete;
+    SqliteNative& operator=(const SqliteNative&) = delete;
+
+    static int progressHandler(void* throttle);
+    static int busyHandler(void* database, int count);
+
+    QString database_file;
+    sqlite3* db;
+    SqliteThrottle* throttle;
+    int busy_timeout;
+    int busy_waited;
+    qint64 lock_wait;
+    QHash<QByteArray, SqliteStatement*> statements;
+};
+
+#endif // SQLITENATIVE_H
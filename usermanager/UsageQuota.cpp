@@ -0,0 +1,477 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include <QFile>
+#include <QVector>
+
+#include "UsageQuota.h"
+
+// the stored text plus the integer columns and the backlog_bufferid_idx entry of a line, roughly
+#define LINE_BYTES(alias) "coalesce(length(CAST(" alias ".message AS BLOB)), 0) + coalesce(length(CAST(" alias ".senderprefixes AS BLOB)), 0) + 32"
+
+// counters of a buffer the core removed, or whose id now belongs to another user
+#define REMOVED_BUFFER(alias) "NOT EXISTS (SELECT 1 FROM buffer b WHERE b.bufferid = " alias ".bufferid AND b.userid = " alias ".userid)"
+
+// the layout of the usage file, older ones are counted again
+static const int usage_version = 1;
+
+UsageQuota::UsageQuota(SqliteNative& database, const QString& file, int size) :
+  db(database), usage_file(file), batch_size(size), counted_rows(0) {
+}
+
+bool UsageQuota::attach() {
+
+  if( !db.attach(usage_file, "usage") )
+    return false;
+
+  if( db.pragma("usage.user_version") != usage_version ) {
+
+    if( !db.exec("DROP TABLE IF EXISTS usage.buffer_usage") ||
+        !db.exec("DROP TABLE IF EXISTS usage.user_usage") ||
+        !db.exec("DROP TABLE IF EXISTS usage.usage_state") )
+      return false;
+
+    QByteArray version = QByteArray("PRAGMA usage.user_version = ") + QByteArray::number(usage_version);
+
+    if( !db.exec(version.constData()) )
+      return false;
+  }
+
+  return db.exec("CREATE TABLE IF NOT EXISTS usage.buffer_usage (bufferid INTEGER PRIMARY KEY, userid INTEGER NOT NULL, rows INTEGER NOT NULL, bytes INTEGER NOT NULL)") &&
+         db.exec("CREATE INDEX IF NOT EXISTS usage.buffer_usage_userid_idx ON buffer_usage(userid, bytes)") &&
+         db.exec("CREATE TABLE IF NOT EXISTS usage.user_usage (userid INTEGER PRIMARY KEY, rows INTEGER NOT NULL, bytes INTEGER NOT NULL)") &&
+         db.exec("CREATE INDEX IF NOT EXISTS usage.user_usage_bytes_idx ON user_usage(bytes)") &&
+         db.exec("CREATE TABLE IF NOT EXISTS usage.usage_state ("
+                 "  id INTEGER PRIMARY KEY CHECK (id = 1), last_messageid INTEGER NOT NULL,"
+                 "  last_time INTEGER NOT NULL, last_bufferid INTEGER NOT NULL)") &&
+         db.exec("CREATE TEMP TABLE IF NOT EXISTS usage_batch (bufferid INTEGER PRIMARY KEY, userid INTEGER NOT NULL, rows INTEGER NOT NULL, bytes INTEGER NOT NULL)");
+}
+
+bool UsageQuota::invalidate(const QString& file) {
+
+  if( !QFile(file).exists() )
+    return true;
+
+  SqliteNative usage(file);
+
+  if( !usage.open() || !usage.hasTable("usage_state") )
+    return usage.isOpen();
+
+  if( !usage.transaction() )
+    return false;
+
+  if( !usage.exec("DELETE FROM buffer_usage") ||
+      !usage.exec("DELETE FROM user_usage") ||
+      !usage.exec("DELETE FROM usage_state") ) {
+    usage.rollback();
+    return false;
+  }
+
+  return usage.commit();
+}
+
+/**
+ * drop the counters of buffers the core removed, and start over when the
+ * watermark line is gone or a line reused its messageid: the deleted lines
+ * can not be subtracted any more
+ */
+bool UsageQuota::checkCounters(qint64& last_messageid) {
+
+  if( !db.transaction(false) )
+    return false;
+
+  SqliteStatement* state = db.statement("SELECT last_messageid, last_time, last_bufferid FROM usage.usage_state WHERE id = 1");
+  SqliteStatement* line = db.statement("SELECT time, bufferid FROM backlog WHERE messageid = ?1");
+
+  if( state == nullptr || line == nullptr ) {
+    db.rollback();
+    return false;
+  }
+
+  last_messageid = 0;
+  qint64 last_time = 0;
+  qint64 last_bufferid = 0;
+
+  if( state->next() ) {
+    last_messageid = state->columnInt64(0);
+    last_time = state->columnInt64(1);
+    last_bufferid = state->columnInt64(2);
+  }
+  state->reset();
+
+  bool same = true;
+
+  if( last_messageid > 0 ) {
+    line->bind(1, last_messageid);
+    same = line->next() && line->columnInt64(0) == last_time && line->columnInt64(1) == last_bufferid;
+    line->reset();
+  }
+
+  bool success = true;
+
+  if( same ) {
+
+    success =
+      db.exec(
+        "UPDATE usage.user_usage"
+        "   SET rows = max(rows - coalesce((SELECT sum(g.rows) FROM usage.buffer_usage g WHERE g.userid = user_usage.userid AND " REMOVED_BUFFER("g") "), 0), 0),"
+        "       bytes = max(bytes - coalesce((SELECT sum(g.bytes) FROM usage.buffer_usage g WHERE g.userid = user_usage.userid AND " REMOVED_BUFFER("g") "), 0), 0)"
+        " WHERE userid IN (SELECT g.userid FROM usage.buffer_usage g WHERE " REMOVED_BUFFER("g") ")") &&
+      db.exec("DELETE FROM usage.buffer_usage WHERE bufferid IN (SELECT g.bufferid FROM usage.buffer_usage g WHERE " REMOVED_BUFFER("g") ")");
+
+  } else {
+
+    std::cerr
+      << "the last counted line " << last_messageid
+      << " was deleted or its messageid reused, counting the backlog again."
+      << std::endl;
+
+    last_messageid = 0;
+
+    success =
+      db.exec("DELETE FROM usage.buffer_usage") &&
+      db.exec("DELETE FROM usage.user_usage") &&
+      db.exec("DELETE FROM usage.usage_state");
+  }
+
+  if( !success ) {
+    std::cerr
+      << std::endl
+      << "ERROR: "
+      << "Unable to check the usage summary"
+      << std::endl
+      << "-"
+      << db.lastError().toStdString()
+      << std::endl;
+
+    db.rollback();
+    return false;
+  }
+
+  return db.commit();
+}
+
+/**
+ * count the lines above the watermark in messageid ordered batches,
+ * every batch commits the counters together with the new watermark
+ *
+ * a batch is summed up per buffer in a temp table first and then added
+ * with INSERT OR IGNORE and UPDATE, upserts need sqlite 3.24
+ */
+bool UsageQuota::update() {
+
+  counted_rows = 0;
+
+  qint64 last_messageid = 0;
+
+  if( !checkCounters(last_messageid) )
+    return false;
+
+  forever {
+
+    // deferred, only the usage database is written to
+    if( !db.transaction(false) )
+      return false;
+
+    SqliteStatement* batch = db.statement(
+      "SELECT max(messageid), count(*) FROM (SELECT messageid FROM backlog WHERE messageid > ?1 ORDER BY messageid LIMIT ?2)");
+    SqliteStatement* sum = db.statement(
+      "INSERT INTO temp.usage_batch (bufferid, userid, rows, bytes)"
+      "  SELECT b.bufferid, coalesce(buf.userid, 0), count(*), sum(" LINE_BYTES("b") ")"
+      "    FROM backlog b LEFT JOIN buffer buf ON buf.bufferid = b.bufferid"
+      "   WHERE b.messageid > ?1 AND b.messageid <= ?2"
+      "   GROUP BY b.bufferid");
+    SqliteStatement* steps[] = {
+      db.statement(
+        "INSERT OR IGNORE INTO usage.buffer_usage (bufferid, userid, rows, bytes)"
+        "  SELECT bufferid, userid, 0, 0 FROM temp.usage_batch"),
+      db.statement(
+        "UPDATE usage.buffer_usage"
+        "   SET rows = rows + (SELECT t.rows FROM temp.usage_batch t WHERE t.bufferid = buffer_usage.bufferid),"
+        "       bytes = bytes + (SELECT t.bytes FROM temp.usage_batch t WHERE t.bufferid = buffer_usage.bufferid)"
+        " WHERE bufferid IN (SELECT bufferid FROM temp.usage_batch)"),
+      db.statement(
+        "INSERT OR IGNORE INTO usage.user_usage (userid, rows, bytes)"
+        "  SELECT DISTINCT userid, 0, 0 FROM temp.usage_batch WHERE userid <> 0"),
+      db.statement(
+        "UPDATE usage.user_usage"
+        "   SET rows = rows + (SELECT sum(t.rows) FROM temp.usage_batch t WHERE t.userid = user_usage.userid),"
+        "       bytes = bytes + (SELECT sum(t.bytes) FROM temp.usage_batch t WHERE t.userid = user_usage.userid)"
+        " WHERE userid IN (SELECT userid FROM temp.usage_batch)"),
+      db.statement("DELETE FROM temp.usage_batch")
+    };
+    SqliteStatement* watermark = db.statement(
+      "INSERT OR REPLACE INTO usage.usage_state (id, last_messageid, last_time, last_bufferid)"
+      "  SELECT 1, messageid, time, bufferid FROM backlog WHERE messageid = ?1");
+
+    bool prepared = ( batch != nullptr && sum != nullptr && watermark != nullptr );
+
+    for( SqliteStatement* step : steps )
+      prepared = prepared && step != nullptr;
+
+    if( !prepared ) {
+      db.rollback();
+      return false;
+    }
+
+    batch->bind(1, last_messageid);
+    batch->bind(2, qint64(batch_size));
+
+    qint64 max_messageid = 0;
+    qint64 rows = 0;
+
+    if( batch->next() ) {
+      max_messageid = batch->columnInt64(0);
+      rows = batch->columnInt64(1);
+    }
+    batch->reset();
+
+    if( rows == 0 ) {
+      db.rollback();
+      break;
+    }
+
+    sum->bind(1, last_messageid);
+    sum->bind(2, max_messageid);
+    watermark->bind(1, max_messageid);
+
+    bool success = sum->exec();
+
+    for( SqliteStatement* step : steps )
+      success = success && step->exec();
+
+    if( !success || !watermark->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to update the usage summary"
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+
+    if( !db.commit() )
+      return false;
+
+    counted_rows += rows;
+    last_messageid = max_messageid;
+
+    if( rows < batch_size )
+      break;
+  }
+
+  return true;
+}
+
+bool UsageQuota::reseed() {
+
+  if( !db.transaction(false) )
+    return false;
+
+  if( !db.exec("DELETE FROM usage.buffer_usage") ||
+      !db.exec("DELETE FROM usage.user_usage") ||
+      !db.exec("DELETE FROM usage.usage_state") ) {
+    db.rollback();
+    return false;
+  }
+
+  if( !db.commit() )
+    return false;
+
+  return update();
+}
+
+bool UsageQuota::overQuota(qint64 limit, QList<UserUsage>& users) {
+
+  SqliteStatement* query = db.statement(
+    "SELECT u.userid, q.username, u.rows, u.bytes"
+    "  FROM usage.user_usage u JOIN quasseluser q ON q.userid = u.userid"
+    " WHERE u.bytes > ?1"
+    " ORDER BY u.bytes DESC");
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, limit);
+
+  while( query->next() ) {
+    UserUsage usage;
+    usage.userid = uint(query->columnInt64(0));
+    usage.username = query->columnText(1);
+    usage.rows = query->columnInt64(2);
+    usage.bytes = query->columnInt64(3);
+    users.append(usage);
+  }
+
+  bool success = ( query->lastResult() == SQLITE_DONE );
+  query->reset();
+
+  return success;
+}
+
+bool UsageQuota::userBytes(uint userid, qint64& bytes) {
+
+  SqliteStatement* query = db.statement("SELECT bytes FROM usage.user_usage WHERE userid = ?1");
+
+  if( query == nullptr )
+    return false;
+
+  query->bind(1, qint64(userid));
+  bytes = query->next() ? query->columnInt64(0) : 0;
+  query->reset();
+
+  return true;
+}
+
+/**
+ * delete the oldest lines of the largest buffer of the user until the user
+ * is below the limit, one write transaction per batch
+ */
+bool UsageQuota::prune(uint userid, qint64 limit, qint64& deleted_rows) {
+
+  deleted_rows = 0;
+
+  // only counted lines can be subtracted again
+  if( !update() )
+    return false;
+
+  SqliteStatement* state = db.statement("SELECT last_messageid FROM usage.usage_state WHERE id = 1");
+
+  if( state == nullptr )
+    return false;
+
+  qint64 last_messageid = state->next() ? state->columnInt64(0) : 0;
+  state->reset();
+
+  forever {
+
+    if( !db.transaction() )
+      return false;
+
+    qint64 bytes = 0;
+
+    if( !userBytes(userid, bytes) ) {
+      db.rollback();
+      return false;
+    }
+
+    if( bytes <= limit ) {
+      db.rollback();
+      break;
+    }
+
+    SqliteStatement* largest = db.statement(
+      "SELECT bufferid, rows, bytes FROM usage.buffer_usage WHERE userid = ?1 AND rows > 0 ORDER BY bytes DESC LIMIT 1");
+    SqliteStatement* oldest = db.statement(
+      "SELECT b.messageid, " LINE_BYTES("b") " FROM backlog b WHERE b.bufferid = ?1 AND b.messageid <= ?2 ORDER BY b.messageid LIMIT ?3");
+    SqliteStatement* remove = db.statement("DELETE FROM backlog WHERE messageid = ?1");
+    SqliteStatement* buffer_usage = db.statement(
+      "UPDATE usage.buffer_usage SET rows = max(rows - ?2, 0), bytes = max(bytes - ?3, 0) WHERE bufferid = ?1");
+    SqliteStatement* user_usage = db.statement(
+      "UPDATE usage.user_usage SET rows = max(rows - ?2, 0), bytes = max(bytes - ?3, 0) WHERE userid = ?1");
+
+    if( largest == nullptr || oldest == nullptr || remove == nullptr || buffer_usage == nullptr || user_usage == nullptr ) {
+      db.rollback();
+      return false;
+    }
+
+    largest->bind(1, qint64(userid));
+
+    if( !largest->next() ) {
+      largest->reset();
+      db.rollback();
+      break;
+    }
+
+    qint64 bufferid = largest->columnInt64(0);
+    qint64 buffer_rows = largest->columnInt64(1);
+    qint64 buffer_bytes = largest->columnInt64(2);
+    largest->reset();
+
+    qint64 excess = bytes - limit;
+    qint64 rows = 0;
+    qint64 freed = 0;
+
+    oldest->bind(1, bufferid);
+    oldest->bind(2, last_messageid);
+    oldest->bind(3, qint64(batch_size));
+
+    QVector<qint64> messageids;
+
+    while( freed < excess && oldest->next() ) {
+      messageids.append(oldest->columnInt64(0));
+      freed += oldest->columnInt64(1);
+    }
+    oldest->reset();
+
+    bool success = true;
+
+    for( qint64 messageid : messageids ) {
+      remove->bind(1, messageid);
+
+      if( !remove->exec() ) {
+        success = false;
+        break;
+      }
+      rows += db.numRowsAffected();
+    }
+
+    // the summary counted lines that are gone by now, drop them from the buffer
+    if( messageids.isEmpty() ) {
+      rows = buffer_rows;
+      freed = buffer_bytes;
+    }
+
+    buffer_usage->bind(1, bufferid);
+    buffer_usage->bind(2, rows);
+    buffer_usage->bind(3, freed);
+    user_usage->bind(1, qint64(userid));
+    user_usage->bind(2, rows);
+    user_usage->bind(3, freed);
+
+    if( !success || !buffer_usage->exec() || !user_usage->exec() ) {
+      std::cerr
+        << std::endl
+        << "ERROR: "
+        << "Unable to prune the backlog of user " << userid
+        << std::endl
+        << "-"
+        << db.lastError().toStdString()
+        << std::endl;
+
+      db.rollback();
+      return false;
+    }
+
+    if( !db.commit() )
+      return false;
+
+    if( !messageids.isEmpty() )
+      deleted_rows += rows;
+  }
+
+  return true;
+}
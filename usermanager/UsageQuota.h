@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef USAGEQUOTA_H
+#define USAGEQUOTA_H
+
+#include <QList>
+#include <QString>
+
+#include "SqliteNative.h"
+
+struct UserUsage {
+    uint userid;
+    QString username;
+    qint64 rows;
+    qint64 bytes;
+};
+
+/*
+ * Per-buffer and per-user backlog usage in a separate database file.
+ *
+ * The counters are seeded once and then only advanced by the lines above
+ * the last counted messageid, so checking the quota costs one row per user
+ * instead of a backlog scan. Lines removed by prune() are subtracted again.
+ * The modes that remove or restore lines (gc, archive, maintain, deleting
+ * users) call invalidate(), the next update() then counts the whole backlog
+ * again like reseed().
+ *
+ * Lines the core deletes itself are caught by update(): the counters of
+ * removed buffers are dropped, and when the last counted line is gone or
+ * its messageid was reused everything is counted again. Single lines the
+ * core deletes below the watermark are not noticed, the counters drift by
+ * those until the next invalidation.
+ */
+class UsageQuota {
+
+public:
+    UsageQuota(SqliteNative& db, const QString& usage_file, int batch_size = 5000);
+
+    bool attach();
+
+    bool update();
+    bool reseed();
+
+    // drops the counters of a usage file that is not attached
+    static bool invalidate(const QString& usage_file);
+
+    bool overQuota(qint64 limit, QList<UserUsage>& users);
+    bool prune(uint userid, qint64 limit, qint64& deleted_rows);
+
+    qint64 countedRows() const { return counted_rows; }
+
+private:
+
+    bool checkCounters(qint64& last_messageid);
+    bool userBytes(uint userid, qint64& bytes);
+
+    SqliteNative& db;
+    QString usage_file;
+    int batch_size;
+    qint64 counted_rows;
+};
+
+#endif // USAGEQUOTA_H
@@ -0,0 +1,243 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#include <iostream>
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "UserSync.h"
+
+UserSync::UserSync(QuasselUser& quassel_user, int size) :
+  qu(quassel_user), batch_size(size), deleted_users(0) {
+}
+
+bool UserSync::load(const QString& desired_file) {
+
+  QFile file(desired_file);
+
+  if( !file.open(QIODevice::ReadOnly | QIODevice::Text) ) {
+    std::cerr
+      << "unable to read the desired state " << desired_file.toStdString() << ".\n"
+      << std::endl;
+    return false;
+  }
+
+  desired.clear();
+  int line_number = 0;
+
+  while( !file.atEnd() ) {
+
+    QByteArray line = file.readLine().trimmed();
+    line_number++;
+
+    if( line.isEmpty() )
+      continue;
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(line, &error);
+
+    QJsonObject object = doc.object();
+    QString username = object.value("username").toString();
+
+    if( error.error != QJsonParseError::NoError || !doc.isObject() || username.isEmpty() ) {
+      std::cerr
+        << "invalid user in line " << line_number << " of " << desired_file.toStdString() << ".\n"
+        << std::endl;
+      return false;
+    }
+
+    if( desired.contains(username) ) {
+      std::cerr
+        << "user " << username.toStdString() << " is listed more than once, the last entry wins."
+        << std::endl;
+    }
+
+    DesiredUser user;
+    user.has_password = object.contains("password");
+    user.password = object.value("password").toString();
+    user.authenticator = object.value("authenticator").toString();
+
+    if( user.authenticator.isEmpty() )
+      user.authenticator = "Database";
+
+    desired.insert(username, user);
+  }
+
+  // an empty export would delete every user of the core
+  if( desired.isEmpty() ) {
+    std::cerr
+      << "the desired state " << desired_file.toStdString() << " contains no users.\n"
+      << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * one pass over the current and one over the desired users, every
+ * lookup goes through a hash
+ */
+void UserSync::plan() {
+
+  planned.clear();
+
+  QHash<QString, uint> current;
+
+  for( const QuasselUserRecord& user : qu.getAllUsers() ) {
+
+    current.insert(user.username, user.userid);
+
+    auto wanted = desired.constFind(user.username);
+
+    if( wanted == desired.constEnd() ) {
+      SyncAction action;
+      action.type = SyncAction::Delete;
+      action.userid = user.userid;
+      action.username = user.username;
+      planned.append(action);
+      continue;
+    }
+
+    if( wanted.value().authenticator != user.authenticator ) {
+      SyncAction action;
+      action.type = SyncAction::ChangeAuthenticator;
+      action.userid = user.userid;
+      action.username = user.username;
+      action.authenticator = wanted.value().authenticator;
+      planned.append(action);
+    }
+
+    if( wanted.value().authenticator == "Database" && wanted.value().has_password &&
+        !qu.checkHashedPassword(wanted.value().password, user.password, user.hashversion) ) {
+      SyncAction action;
+      action.type = SyncAction::ResetPassword;
+      action.userid = user.userid;
+      action.username = user.username;
+      action.password = wanted.value().password;
+      planned.append(action);
+    }
+  }
+
+  for( auto it = desired.constBegin(); it != desired.constEnd(); ++it ) {
+
+    if( current.contains(it.key()) )
+      continue;
+
+    if( it.value().authenticator == "Database" && !it.value().has_password ) {
+      std::cerr
+        << "user " << it.key().toStdString() << " has no password and is not added."
+        << std::endl;
+      continue;
+    }
+
+    SyncAction action;
+    action.type = SyncAction::Add;
+    action.userid = 0;
+    action.username = it.key();
+    action.password = it.value().password;
+    action.authenticator = it.value().authenticator;
+    planned.append(action);
+  }
+}
+
+void UserSync::printPlan() const {
+
+  for( const SyncAction& action : planned ) {
+
+    switch( action.type ) {
+      case SyncAction::Add:
+        std::cout << "add " << action.username.toStdString() << " (" << action.authenticator.toStdString() << ")";
+        break;
+      case SyncAction::Delete:
+        std::cout << "delete " << action.username.toStdString();
+        break;
+      case SyncAction::ResetPassword:
+        std::cout << "reset password " << action.username.toStdString();
+        break;
+      case SyncAction::ChangeAuthenticator:
+        std::cout << "set authenticator " << action.username.toStdString() << " " << action.authenticator.toStdString();
+        break;
+    }
+
+    std::cout << std::endl;
+  }
+}
+
+/**
+ * every kind of change is applied in transactions of batch_size users
+ */
+bool UserSync::apply() {
+
+  QHash<QString, QList<QPair<QString, QString> > > adds;
+  QList<uint> deletes;
+  QList<QPair<uint, QString> > passwords;
+  QList<QPair<uint, QString> > authenticators;
+
+  for( const SyncAction& action : planned ) {
+
+    switch( action.type ) {
+      case SyncAction::Add:
+        adds[action.authenticator].append(qMakePair(action.username, action.password));
+        break;
+      case SyncAction::Delete:
+        deletes.append(action.userid);
+        break;
+      case SyncAction::ResetPassword:
+        passwords.append(qMakePair(action.userid, action.password));
+        break;
+      case SyncAction::ChangeAuthenticator:
+        authenticators.append(qMakePair(action.userid, action.authenticator));
+        break;
+    }
+  }
+
+  int expected = planned.size();
+  int applied = 0;
+
+  deleted_users = 0;
+
+  for( int i = 0; i < deletes.size(); i += batch_size )
+    deleted_users += qu.deleteUsers(deletes.mid(i, batch_size));
+
+  applied += deleted_users;
+
+  for( int i = 0; i < authenticators.size(); i += batch_size )
+    applied += qu.setUserAuthenticators(authenticators.mid(i, batch_size));
+
+  for( int i = 0; i < passwords.size(); i += batch_size )
+    applied += qu.updateUsers(passwords.mid(i, batch_size));
+
+  for( auto it = adds.constBegin(); it != adds.constEnd(); ++it ) {
+    for( int i = 0; i < it.value().size(); i += batch_size )
+      applied += qu.addUsers(it.value().mid(i, batch_size), it.key());
+  }
+
+  if( applied != expected ) {
+    std::cerr
+      << "only " << applied << " of " << expected << " changes were applied."
+      << std::endl;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   Copyright (C) 2019 by Bodo Schulz                                     *
+ *   bodo@boone-schulz.de                                                  *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) version 3.                                           *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.         *
+ ***************************************************************************/
+
+#ifndef USERSYNC_H
+#define USERSYNC_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include "QuasselUser.h"
+
+struct SyncAction {
+    enum Type {
+      Add,
+      Delete,
+      ResetPassword,
+      ChangeAuthenticator
+    };
+
+    Type type;
+    uint userid;
+    QString username;
+    QString password;
+    QString authenticator;
+};
+
+/*
+ * Reconciles the users of the core against a desired state, one JSON
+ * object per line:
+ *
+ *   {"username": "alice", "password": "secret", "authenticator": "Database"}
+ *
+ * password is optional for existing users and ignored for every other
+ * authenticator than "Database". Users that are missing from the file
+ * are deleted.
+ */
+class UserSync {
+
+public:
+    UserSync(QuasselUser& qu, int batch_size = 5000);
+
+    bool load(const QString& desired_file);
+    void plan();
+    bool apply();
+
+    void printPlan() const;
+    QList<SyncAction> actions() const { return planned; }
+    int deletedUsers() const { return deleted_users; }
+
+private:
+
+    struct DesiredUser {
+      QString password;
+      QString authenticator;
+      bool has_password;
+    };
+
+    QuasselUser& qu;
+    int batch_size;
+
+    QHash<QString, DesiredUser> desired;
+    QList<SyncAction> planned;
+    int deleted_users;
+};
+
+#endif // USERSYNC_H
@@ -1,5 +1,6 @@
 
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <getopt.h>
 #include <sstream>
@@ -9,16 +10,35 @@
 
 #include <QString>
 
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QFileInfo>
+#include <QSettings>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QSqlError>
+#include <QStringList>
 #include <QCryptographicHash>
 
 #include <QDebug>
 
 #include <QuasselUser.h>
+#include <Benchmark.h>
+#include <LoadSimulator.h>
+#include <GarbageCollector.h>
+#include <BacklogSearch.h>
+#include <UsageQuota.h>
+#include <UserSync.h>
+#include <BacklogArchive.h>
+#include <Maintenance.h>
+#include <LogImport.h>
+#include <ChangeFeed.h>
+#include <GrowthSampler.h>
+#ifdef HAVE_POSTGRESQL
+#include <PostgreSqlUser.h>
+#endif
 
 
 const char *progname = "quasselcore-usermanager";
@@ -28,6 +48,9 @@ const char *email = "Bodo Schulz <bodo@boone-schulz.de>";
 
 void print_help (void);
 void print_usage (void);
+qint64 parse_size(const QString& size);
+qint64 parse_time(const QString& time);
+void invalidate_usage(const QString& usage_file);
 QString hashPasswordSha2_512(const QString& password);
 QString sha2_512(const QString& input);
 
@@ -37,7 +60,22 @@ enum Mode {
   delete_user,
   update_user,
   rename_user,
-  validate_user
+  validate_user,
+  batch_add_user,
+  benchmark,
+  simulation,
+  garbage_collect,
+  index_backlog,
+  search_backlog,
+  quota,
+  sync_users,
+  export_users,
+  archive_backlog,
+  restore_backlog,
+  maintenance,
+  import_logs,
+  follow_backlog,
+  sample_growth
 };
 
 // ------------------------------------------------------------------------------------------------
@@ -45,11 +83,45 @@ enum Mode {
 int main(int argc, char *argv[]) {
 
   QString database_file = "";
+  QString config_file = "";
   QString quassel_user = "";
   QString quassel_password = "";
+  QString batch_file = "";
+  bool native_backend = false;
+  int benchmark_count = 0;
+  int simulation_rate = 0;
+  int batch_size = 5000;
+  QString index_file = "";
+  QString search_query = "";
+  QString buffer_name = "";
+  int limit = 50;
+  QString usage_file = "";
+  qint64 quota_limit = -1;
+  bool prune = false;
+  bool reseed = false;
+  QString desired_file = "";
+  bool dry_run = false;
+  QString archive_file = "";
+  qint64 archive_before = -1;
+  qint64 restore_from = -1;
+  qint64 restore_to = -1;
+  qint64 maintenance_budget = -1;
+  qint64 retention_before = -1;
+  int step_time = 200;
+  QStringList import_paths;
+  QString import_network = "";
+  int import_jobs = 0;
+  bool force = false;
+  QString feed_file = "";
+  QString output_file = "";
+  bool tail = false;
+  int poll_interval = -1;
+  QString sample_file = "";
+  int ring_size = 1440;
+  bool detail = false;
 
   int opt = 0;
-  const char* const short_opts = "hVladrvuU:P:f:";
+  const char* const short_opts = "hVladrvungipRNxU:P:f:b:B:D:s:I:Q:c:L:q:F:y:C:A:T:Z:M:E:S:m:w:j:zWto:k:e:G:X:Y";
   const option long_opts[] = {
     {"help"    , no_argument      , nullptr, 'h'},
     {"version" , no_argument      , nullptr, 'V'},
@@ -64,6 +136,53 @@ int main(int argc, char *argv[]) {
     {"user"    , required_argument, nullptr, 'U'},
     {"password", required_argument, nullptr, 'P'},
     {"file"    , required_argument, nullptr, 'f'},
+    {"config"  , required_argument, nullptr, 'C'},
+    {"export"  , no_argument      , nullptr, 'x'},
+
+    {"native"   , no_argument      , nullptr, 'n'},
+    {"batch"    , required_argument, nullptr, 'b'},
+    {"benchmark", required_argument, nullptr, 'B'},
+    {"simulate" , required_argument, nullptr, 'D'},
+
+    {"gc"        , no_argument      , nullptr, 'g'},
+    {"batch-size", required_argument, nullptr, 's'},
+
+    {"index"     , no_argument      , nullptr, 'i'},
+    {"index-file", required_argument, nullptr, 'I'},
+    {"search"    , required_argument, nullptr, 'Q'},
+    {"buffer"    , required_argument, nullptr, 'c'},
+    {"limit"     , required_argument, nullptr, 'L'},
+
+    {"quota"     , required_argument, nullptr, 'q'},
+    {"prune"     , no_argument      , nullptr, 'p'},
+    {"reseed"    , no_argument      , nullptr, 'R'},
+    {"usage-file", required_argument, nullptr, 'F'},
+
+    {"sync"      , required_argument, nullptr, 'y'},
+    {"dry-run"   , no_argument      , nullptr, 'N'},
+
+    {"archive"     , required_argument, nullptr, 'A'},
+    {"restore"     , required_argument, nullptr, 'T'},
+    {"archive-file", required_argument, nullptr, 'Z'},
+
+    {"maintain"    , required_argument, nullptr, 'M'},
+    {"retention"   , required_argument, nullptr, 'E'},
+    {"step"        , required_argument, nullptr, 'S'},
+
+    {"import"      , required_argument, nullptr, 'm'},
+    {"network"     , required_argument, nullptr, 'w'},
+    {"jobs"        , required_argument, nullptr, 'j'},
+    {"force"       , no_argument      , nullptr, 'z'},
+
+    {"follow"      , no_argument      , nullptr, 'W'},
+    {"tail"        , no_argument      , nullptr, 't'},
+    {"output"      , required_argument, nullptr, 'o'},
+    {"feed-file"   , required_argument, nullptr, 'k'},
+    {"interval"    , required_argument, nullptr, 'e'},
+
+    {"sample"      , required_argument, nullptr, 'G'},
+    {"samples"     , required_argument, nullptr, 'X'},
+    {"detail"      , no_argument      , nullptr, 'Y'},
     {nullptr   , 0, nullptr, 0}
   };
 
@@ -103,12 +222,135 @@ int main(int argc, char *argv[]) {
       case 'f':
         database_file = optarg;
         break;
+      case 'C':
+        config_file = optarg;
+        break;
+      case 'x':
+        mode = export_users;
+        break;
       case 'U':
         quassel_user = optarg;
         break;
       case 'P':
         quassel_password = optarg;
         break;
+      case 'n':
+        native_backend = true;
+        break;
+      case 'b':
+        mode = batch_add_user;
+        batch_file = optarg;
+        break;
+      case 'B':
+        mode = benchmark;
+        benchmark_count = QString(optarg).toInt();
+        break;
+      case 'D':
+        mode = simulation;
+        simulation_rate = QString(optarg).toInt();
+        break;
+      case 'g':
+        mode = garbage_collect;
+        break;
+      case 's':
+        batch_size = QString(optarg).toInt();
+        break;
+      case 'i':
+        mode = index_backlog;
+        break;
+      case 'I':
+        index_file = optarg;
+        break;
+      case 'Q':
+        mode = search_backlog;
+        search_query = QString::fromUtf8(optarg);
+        break;
+      case 'c':
+        buffer_name = QString::fromUtf8(optarg);
+        break;
+      case 'L':
+        limit = QString(optarg).toInt();
+        break;
+      case 'q':
+        mode = quota;
+        quota_limit = parse_size(optarg);
+        break;
+      case 'p':
+        prune = true;
+        break;
+      case 'R':
+        reseed = true;
+        break;
+      case 'F':
+        usage_file = optarg;
+        break;
+      case 'y':
+        mode = sync_users;
+        desired_file = optarg;
+        break;
+      case 'N':
+        dry_run = true;
+        break;
+      case 'A':
+        mode = archive_backlog;
+        archive_before = parse_time(optarg);
+        break;
+      case 'T':
+        mode = restore_backlog;
+        restore_from = parse_time(QString(optarg).section(',', 0, 0));
+        restore_to = parse_time(QString(optarg).section(',', 1, 1));
+        break;
+      case 'Z':
+        archive_file = optarg;
+        break;
+      case 'M':
+        mode = maintenance;
+        maintenance_budget = QString(optarg).toLongLong() * 1000;
+        break;
+      case 'E':
+        retention_before = parse_time(optarg);
+        break;
+      case 'S':
+        step_time = QString(optarg).toInt();
+        break;
+      case 'm':
+        mode = import_logs;
+        import_paths.append(QString::fromLocal8Bit(optarg));
+        break;
+      case 'w':
+        import_network = QString::fromUtf8(optarg);
+        break;
+      case 'j':
+        import_jobs = QString(optarg).toInt();
+        break;
+      case 'z':
+        force = true;
+        break;
+      case 'W':
+        mode = follow_backlog;
+        break;
+      case 't':
+        tail = true;
+        break;
+      case 'o':
+        output_file = optarg;
+        break;
+      case 'k':
+        feed_file = optarg;
+        break;
+      case 'e':
+        poll_interval = QString(optarg).toInt();
+        break;
+      case 'G':
+        mode = sample_growth;
+        sample_file = optarg;
+        break;
+      case 'X':
+        ring_size = QString(optarg).toInt();
+        break;
+      case 'Y':
+        detail = true;
+        break;
       default:
         print_usage();
 
@@ -121,10 +363,60 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if( mode == benchmark ) {
+
+    if( benchmark_count <= 0 ) {
+      print_usage();
+      std::cerr
+        << "the benchmark needs a user count greater than 0.\n"
+        << std::endl;
+      return 1;
+    }
+
+    return runBenchmark(benchmark_count);
+  }
+
+  if( mode == simulation ) {
+
+    if( simulation_rate <= 0 || batch_size <= 0 ) {
+      print_usage();
+      std::cerr
+        << "the simulation needs a message rate and a batch size greater than 0.\n"
+        << std::endl;
+      return 1;
+    }
+
+    return runLoadSimulation(simulation_rate, batch_size);
+  }
+
   /**
    * validate it
    */
-  if(database_file.isEmpty()) {
+  QString storage_backend = "SQLite";
+  QVariantMap storage_properties;
+
+  if( !config_file.isEmpty() ) {
+
+    if( QFile(config_file).exists() == false ) {
+      print_usage();
+      std::cerr
+        << "The configuration file " << config_file.toStdString() << " does not exist.\n"
+        << std::endl;
+      return 1;
+    }
+
+    QSettings settings( config_file,  QSettings::IniFormat );
+    QVariantMap storage = settings.value("Core/StorageSettings").toMap();
+
+    storage_backend = storage.value("Backend", "SQLite").toString();
+    storage_properties = storage.value("ConnectionProperties").toMap();
+
+    // the core keeps its sqlite database next to the config file
+    if( storage_backend == "SQLite" && database_file.isEmpty() )
+      database_file = QFileInfo(config_file).absolutePath() + "/quassel-storage.sqlite";
+  }
+
+  if( storage_backend == "SQLite" && database_file.isEmpty() ) {
     print_usage();
     std::cerr
       << "we need an database file.\n"
@@ -132,7 +424,10 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  if( mode != list_user && quassel_user.isEmpty() ) {
+  bool needs_user = ( mode == add_user || mode == delete_user || mode == update_user || mode == rename_user || mode == validate_user || mode == import_logs );
+  bool needs_password = ( mode == add_user || mode == update_user || mode == rename_user || mode == validate_user );
+
+  if( needs_user && quassel_user.isEmpty() ) {
     print_usage();
     std::cerr
       << "missing user.\n"
@@ -140,7 +435,7 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  if( ( mode != list_user && mode != delete_user ) && quassel_password.isEmpty() ) {
+  if( needs_password && quassel_password.isEmpty() ) {
     print_usage();
     std::cerr
       << "missing password.\n"
@@ -149,7 +444,7 @@ int main(int argc, char *argv[]) {
   }
 
 
-  if( QFile(database_file).exists() == false ) {
+  if( storage_backend == "SQLite" && QFile(database_file).exists() == false ) {
     print_usage();
     std::cerr
       << "The database file " << database_file.toStdString() << " does not exist.\n"
@@ -157,11 +452,118 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if( !buffer_name.isEmpty() && quassel_user.isEmpty() ) {
+    print_usage();
+    std::cerr
+      << "a buffer can only be selected together with --user.\n"
+      << std::endl;
+    return 1;
+  }
+
+  // the side files sit next to the sqlite database, the other backends have
+  // none, an empty database_file would put them in the working directory
+  if( storage_backend == "SQLite" ) {
+
+    if( index_file.isEmpty() )
+      index_file = database_file + ".fts";
+
+    if( usage_file.isEmpty() )
+      usage_file = database_file + ".usage";
+
+    if( archive_file.isEmpty() )
+      archive_file = database_file + ".archive";
+
+    if( feed_file.isEmpty() )
+      feed_file = database_file + ".feed";
+  }
+
+  if( mode == archive_backlog && archive_before < 0 ) {
+    print_usage();
+    std::cerr
+      << "invalid cutoff, use <days>d or an ISO date.\n"
+      << std::endl;
+    return 1;
+  }
+
+  if( mode == restore_backlog && ( restore_from < 0 || restore_to <= restore_from ) ) {
+    print_usage();
+    std::cerr
+      << "invalid range, use <from>,<to> with <days>d or ISO dates.\n"
+      << std::endl;
+    return 1;
+  }
+
+  if( mode == maintenance && ( maintenance_budget <= 0 || step_time <= 0 || batch_size <= 0 ) ) {
+    print_usage();
+    std::cerr
+      << "the maintenance needs a time budget in seconds, a step time and a batch size greater than 0.\n"
+      << std::endl;
+    return 1;
+  }
+
+  if( poll_interval < 0 )
+    poll_interval = ( mode == sample_growth ) ? 60000 : 1000;
+
+  if( mode == sample_growth && ( poll_interval <= 0 || ring_size <= 0 ) ) {
+    print_usage();
+    std::cerr
+      << "the sampler needs an interval and a number of samples greater than 0.\n"
+      << std::endl;
+    return 1;
+  }
+
+  if( mode == follow_backlog && ( poll_interval <= 0 || batch_size <= 0 ) ) {
+    print_usage();
+    std::cerr
+      << "the feed needs a poll interval and a batch size greater than 0.\n"
+      << std::endl;
+    return 1;
+  }
+
+  if( mode == quota && quota_limit < 0 ) {
+    print_usage();
+    std::cerr
+      << "invalid quota, use bytes with an optional K, M or G suffix.\n"
+      << std::endl;
+    return 1;
+  }
+
   /**
    *
    */
 
-  QuasselUser qu(database_file);
+  QScopedPointer<QuasselUser> storage;
+
+  if( storage_backend == "SQLite" ) {
+    storage.reset(new QuasselUser(database_file));
+  } else
+  if( storage_backend == "PostgreSQL" ) {
+#ifdef HAVE_POSTGRESQL
+    storage.reset(new PostgreSqlUser(storage_properties));
+#else
+    std::cerr
+      << "this build has no support for the PostgreSQL storage backend.\n"
+      << std::endl;
+    return 1;
+#endif
+  } else {
+    std::cerr
+      << "unsupported storage backend " << storage_backend.toStdString() << ".\n"
+      << std::endl;
+    return 1;
+  }
+
+  QuasselUser& qu = *storage;
+
+  if( !qu.isAvailable() ) {
+    std::cerr
+      << "the Qt sql driver for " << qu.displayName().toStdString() << " is not available.\n"
+      << std::endl;
+    return 1;
+  }
+
+  // the native backend only exists for sqlite
+  qu.setNativeBackend(native_backend && storage_backend == "SQLite");
 
   if( mode == add_user ) {
 
@@ -176,6 +578,470 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
+  } else
+  if( mode == batch_add_user ) {
+
+    QFile file(batch_file);
+
+    if( !file.open(QIODevice::ReadOnly | QIODevice::Text) ) {
+      std::cerr
+        << "unable to read the batch file " << batch_file.toStdString() << ".\n"
+        << std::endl;
+      return 1;
+    }
+
+    // one user per line: <username> <password>
+    QList<QPair<QString, QString> > users;
+
+    while( !file.atEnd() ) {
+      QString line = QString::fromUtf8(file.readLine()).trimmed();
+
+      if( line.isEmpty() || line.startsWith('#') )
+        continue;
+
+      int separator = line.indexOf(QRegExp("\\s"));
+
+      if( separator <= 0 ) {
+        std::cerr
+          << "skip invalid line: " << line.toStdString()
+          << std::endl;
+        continue;
+      }
+
+      users.append(qMakePair(line.left(separator), line.mid(separator + 1).trimmed()));
+    }
+
+    int added = qu.addUsers(users);
+
+    std::cout
+      << added
+      << " of "
+      << users.size()
+      << " users successfuly added"
+      << std::endl;
+
+    return ( added == users.size() ) ? 0 : 1;
+
+  } else
+  if( mode == garbage_collect ) {
+
+    if( batch_size <= 0 ) {
+      print_usage();
+      std::cerr
+        << "the batch size must be greater than 0.\n"
+        << std::endl;
+      return 1;
+    }
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    GarbageCollector gc(*db, batch_size);
+
+    bool collected = gc.run();
+
+    // only deleted lines change the counters, the backlog is collected first
+    // and a run without its entry failed there after committing batches
+    qint64 removed = collected ? 0 : 1;
+
+    for( auto e : gc.deletedRows() ) {
+      if( e.first == "backlog" )
+        removed = e.second;
+    }
+
+    if( removed > 0 )
+      invalidate_usage(usage_file);
+
+    if( !collected ) {
+      std::cerr
+        << "garbage collection failed, already finished batches are committed."
+        << std::endl;
+      return 1;
+    }
+
+    for( auto e : gc.deletedRows() ) {
+      std::cout
+        << "table: "
+        << e.first.toStdString()
+        << ", deleted rows: " << e.second
+        << std::endl;
+    }
+
+    std::cout
+      << "reclaimed pages: "
+      << gc.freedPages()
+      << " (" << gc.freedPages() * gc.pageSize() << " bytes)"
+      << std::endl;
+
+  } else
+  if( mode == index_backlog || mode == search_backlog ) {
+
+    uint userid = 0;
+
+    if( !quassel_user.isEmpty() ) {
+      userid = qu.getUserId(quassel_user);
+
+      if( userid == 0 ) {
+        std::cerr
+          << "unknown user " << quassel_user.toStdString() << ".\n"
+          << std::endl;
+        return 1;
+      }
+    }
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    BacklogSearch search(*db, index_file, batch_size);
+
+    if( !search.attach() )
+      return 1;
+
+    if( mode == index_backlog ) {
+
+      if( !search.update(userid, buffer_name) ) {
+        std::cerr
+          << "indexing failed, already finished batches are committed."
+          << std::endl;
+        return 1;
+      }
+
+      std::cout
+        << "indexed lines: "
+        << search.indexedRows()
+        << std::endl;
+
+      return 0;
+    }
+
+    QList<BacklogSearchResult> results;
+
+    if( !search.search(search_query, results, userid, buffer_name, limit) )
+      return 1;
+
+    for( auto e : results ) {
+      std::cout
+        << QDateTime::fromMSecsSinceEpoch(e.time).toString(Qt::ISODate).toStdString()
+        << " " << e.buffer.toStdString()
+        << " <" << e.sender.toStdString() << "> "
+        << e.message.toStdString()
+        << std::endl;
+    }
+
+  } else
+  if( mode == quota ) {
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    UsageQuota usage(*db, usage_file, batch_size);
+
+    if( !usage.attach() )
+      return 1;
+
+    if( !( reseed ? usage.reseed() : usage.update() ) ) {
+      std::cerr
+        << "updating the usage summary failed, already finished batches are committed."
+        << std::endl;
+      return 1;
+    }
+
+    QList<UserUsage> users;
+
+    if( !usage.overQuota(quota_limit, users) )
+      return 1;
+
+    for( auto e : users ) {
+      std::cout
+        << "uid: "
+        << e.userid
+        << ", username: " << e.username.toStdString()
+        << ", lines: " << e.rows
+        << ", bytes: " << e.bytes;
+
+      if( prune ) {
+        qint64 deleted = 0;
+
+        if( !usage.prune(e.userid, quota_limit, deleted) ) {
+          std::cout << std::endl;
+          return 1;
+        }
+
+        std::cout << ", pruned lines: " << deleted;
+      }
+
+      std::cout << std::endl;
+    }
+
+    return ( users.isEmpty() || prune ) ? 0 : 2;
+
+  } else
+  if( mode == sync_users ) {
+
+    UserSync sync(qu, batch_size);
+
+    if( !sync.load(desired_file) )
+      return 1;
+
+    sync.plan();
+    sync.printPlan();
+
+    if( dry_run )
+      return 0;
+
+    bool applied = sync.apply();
+
+    // deleted users take their backlog with them
+    if( sync.deletedUsers() > 0 )
+      invalidate_usage(usage_file);
+
+    if( !applied )
+      return 1;
+
+    std::cout
+      << sync.actions().size()
+      << " changes applied"
+      << std::endl;
+
+  } else
+  if( mode == archive_backlog || mode == restore_backlog ) {
+
+    uint userid = 0;
+
+    if( !quassel_user.isEmpty() ) {
+      userid = qu.getUserId(quassel_user);
+
+      if( userid == 0 ) {
+        std::cerr
+          << "unknown user " << quassel_user.toStdString() << ".\n"
+          << std::endl;
+        return 1;
+      }
+    }
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    BacklogArchive archive(*db, archive_file, batch_size);
+
+    if( !archive.attach() )
+      return 1;
+
+    bool success = ( mode == archive_backlog ) ?
+      archive.archive(archive_before, userid) :
+      archive.restore(restore_from, restore_to, userid);
+
+    // restored lines sit below the watermark of the usage counters
+    if( !success || archive.movedRows() > 0 )
+      invalidate_usage(usage_file);
+
+    if( !success ) {
+      std::cerr
+        << "moving the backlog failed, already finished batches are committed."
+        << std::endl;
+      return 1;
+    }
+
+    std::cout
+      << ( mode == archive_backlog ? "archived" : "restored" ) << " lines: "
+      << archive.movedRows()
+      << std::endl
+      << "reclaimed pages: "
+      << archive.freedPages()
+      << " (" << archive.freedPages() * archive.pageSize() << " bytes)"
+      << std::endl;
+
+  } else
+  if( mode == maintenance ) {
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    MaintenanceRunner runner(*db, database_file + ".maintenance", batch_size, maintenance_budget, step_time);
+
+    if( !runner.attach() )
+      return 1;
+
+    if( retention_before >= 0 )
+      runner.setRetention(retention_before, archive_file);
+
+    bool success = runner.run();
+
+    if( runner.removedRows() > 0 )
+      invalidate_usage(usage_file);
+
+    for( auto e : runner.jobs() ) {
+      std::cout
+        << "job: "
+        << e.name.toStdString()
+        << ", finished: " << ( e.finished ? "yes" : "no" )
+        << ", time: " << e.elapsed << " ms"
+        << ", next batch size: " << e.batch_size
+        << std::endl;
+    }
+
+    std::cout
+      << "waited for the core: "
+      << runner.waited() << " ms"
+      << ", busy: " << runner.busyCount()
+      << std::endl;
+
+    if( runner.stopped() ) {
+      std::cout
+        << ( runner.cancelled() ? "cancelled" : "time budget used up" )
+        << ", the next run continues with the unfinished jobs"
+        << std::endl;
+    }
+
+    if( !success )
+      return 1;
+
+  } else
+  if( mode == import_logs ) {
+
+    if( batch_size <= 0 ) {
+      print_usage();
+      std::cerr
+        << "the batch size must be greater than 0.\n"
+        << std::endl;
+      return 1;
+    }
+
+    uint userid = qu.getUserId(quassel_user);
+
+    if( userid == 0 ) {
+      std::cerr
+        << "unknown user " << quassel_user.toStdString() << ".\n"
+        << std::endl;
+      return 1;
+    }
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    LogImport import(*db, userid, batch_size, import_jobs);
+
+    if( !import_network.isEmpty() )
+      import.setNetwork(import_network);
+
+    import.setForce(force);
+
+    for( const QString& path : import_paths ) {
+      if( !import.addPath(path) )
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    bool success = import.run();
+
+    std::cout
+      << "imported lines: "
+      << import.importedRows()
+      << " from " << import.files() << " files into " << import.buffers() << " buffers"
+      << ", skipped lines: " << import.skippedLines()
+      << ", skipped buffers: " << import.refusedBuffers()
+      << ", time: " << timer.elapsed() << " ms"
+      << std::endl;
+
+    if( !success ) {
+      std::cerr
+        << "the import failed, already finished batches are committed."
+        << std::endl;
+      return 1;
+    }
+
+  } else
+  if( mode == follow_backlog ) {
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    ChangeFeed feed(*db, feed_file, batch_size);
+
+    if( !feed.attach() )
+      return 1;
+
+    std::ofstream file;
+
+    if( !output_file.isEmpty() ) {
+      file.open(output_file.toLocal8Bit().constData(), std::ios::out | std::ios::app);
+
+      if( !file.is_open() ) {
+        std::cerr
+          << "unable to open " << output_file.toStdString() << ".\n"
+          << std::endl;
+        return 1;
+      }
+    }
+
+    std::ostream& out = output_file.isEmpty() ? std::cout : file;
+
+    bool success = tail ? feed.follow(out, poll_interval) : feed.poll(out);
+
+    // stdout may carry the feed itself
+    std::cerr
+      << "shipped lines: "
+      << feed.shippedRows()
+      << ", watermark: " << feed.watermark()
+      << std::endl;
+
+    if( !success )
+      return 1;
+
+  } else
+  if( mode == sample_growth ) {
+
+    SqliteNative* db = qu.nativeDb();
+
+    if( db == nullptr )
+      return 1;
+
+    GrowthSampler sampler(*db, sample_file, ring_size);
+    sampler.setDetail(detail);
+
+    if( detail && !sampler.hasDbstat() ) {
+      std::cerr
+        << "this sqlite is built without dbstat, sampling without pages per table and index."
+        << std::endl;
+    }
+
+    if( !( tail ? sampler.run(poll_interval) : sampler.sample() ) )
+      return 1;
+
+    const GrowthSample& sample = sampler.last();
+
+    std::cout
+      << "pages: "
+      << sample.page_count
+      << " (" << sample.page_count * sample.page_size << " bytes)"
+      << ", free pages: " << sample.freelist_count
+      << ", wal: " << sample.wal_bytes << " bytes"
+      << ", new lines: " << sample.new_lines
+      << ", new pages: " << sample.new_pages
+      << std::endl;
+
+  } else
+  if( mode == export_users ) {
+
+    if( !qu.exportUsers(std::cout) )
+      return 1;
+
   } else
   if( mode == delete_user ) {
 
@@ -184,7 +1050,8 @@ int main(int argc, char *argv[]) {
       << quassel_user.toStdString()
       << std::endl;
 
-    qu.deleteUser(quassel_user);
+    if( qu.deleteUser(quassel_user) > 0 )
+      invalidate_usage(usage_file);
 
   } else
   if( mode == update_user ) {
@@ -220,6 +1087,7 @@ int main(int argc, char *argv[]) {
   } else
   if( mode == validate_user ) {
 
+    // a single lookup, the credential index only pays off for many logins
     if( qu.validateUser(quassel_user, quassel_password) != 0 ) {
 
       std::cout
@@ -272,6 +1140,8 @@ void print_help (void) {
     << "    Print version information" << std::endl
     << " -f, --file <database file>" << std::endl
     << "    sqlite database file." << std::endl
+    << " -C, --config <config file>" << std::endl
+    << "    quasselcore.conf, the storage backend (SQLite or PostgreSQL) is taken from Core/StorageSettings." << std::endl
     << " -a, --add" << std::endl
     << "    add an quassel core user (requires --user and --password)." << std::endl
     << " -d, --delete" << std::endl
@@ -284,6 +1154,80 @@ void print_help (void) {
     << "    set an new password of an existing quassel core user (requires --user and --password) (INSECURE, NO DOUBLE CHECK YET)" << std::endl
     << " -l, --list" << std::endl
     << "    list all quassel core users." << std::endl
+    << " -x, --export" << std::endl
+    << "    write all users as JSONL (userid, username, authenticator) to stdout." << std::endl
+    << " -b, --batch <file>" << std::endl
+    << "    add all users of a file, one '<username> <password>' per line." << std::endl
+    << " -n, --native" << std::endl
+    << "    use the native sqlite3 backend for bulk operations (list, batch)." << std::endl
+    << " -B, --benchmark <count>" << std::endl
+    << "    compare the QtSql and the native backend on a scratch database with <count> users." << std::endl
+    << " -D, --simulate <msgs/s>" << std::endl
+    << "    run the bulk and maintenance modes on a scratch database while a simulated core writes <msgs/s> messages and report its write latency." << std::endl
+    << " -g, --gc" << std::endl
+    << "    delete backlog, buffers, senders and settings no user or buffer refers to anymore." << std::endl
+    << " -s, --batch-size <rows>" << std::endl
+    << "    rows per transaction for the maintenance modes (default: 5000)." << std::endl
+    << " -i, --index" << std::endl
+    << "    add new backlog lines to the full-text index (all users, or --user and --buffer)." << std::endl
+    << " -Q, --search <query>" << std::endl
+    << "    search the full-text index (FTS5 query syntax), optionally limited to --user and --buffer." << std::endl
+    << " -I, --index-file <file>" << std::endl
+    << "    the full-text index database (default: <database file>.fts)." << std::endl
+    << " -c, --buffer <name>" << std::endl
+    << "    limit --index and --search to one buffer (channel or query) of --user." << std::endl
+    << " -L, --limit <count>" << std::endl
+    << "    maximum number of search results (default: 50)." << std::endl
+    << " -q, --quota <bytes>" << std::endl
+    << "    list users whose backlog exceeds <bytes> (K, M and G suffixes allowed), exit code 2 if any." << std::endl
+    << " -p, --prune" << std::endl
+    << "    with --quota, delete the oldest lines of the largest buffers until the users fit again." << std::endl
+    << " -R, --reseed" << std::endl
+    << "    with --quota, count the whole backlog again instead of only the new lines." << std::endl
+    << " -F, --usage-file <file>" << std::endl
+    << "    the usage summary database (default: <database file>.usage)." << std::endl
+    << " -y, --sync <file>" << std::endl
+    << "    add, delete and update users to match a JSONL export (one {\"username\", \"password\", \"authenticator\"} per line)." << std::endl
+    << " -N, --dry-run" << std::endl
+    << "    with --sync, only print the changes." << std::endl
+    << " -A, --archive <cutoff>" << std::endl
+    << "    move backlog older than <cutoff> (<days>d or an ISO date) to the archive, optionally only of --user." << std::endl
+    << " -T, --restore <from>,<to>" << std::endl
+    << "    move archived backlog of the time range back into the database, optionally only of --user." << std::endl
+    << " -Z, --archive-file <file>" << std::endl
+    << "    the backlog archive database (default: <database file>.archive)." << std::endl
+    << " -M, --maintain <seconds>" << std::endl
+    << "    run retention (with --retention), gc and vacuum in small steps for at most <seconds>, backing off while the core writes." << std::endl
+    << " -E, --retention <cutoff>" << std::endl
+    << "    with --maintain, archive backlog older than <cutoff> (<days>d or an ISO date) first." << std::endl
+    << " -S, --step <ms>" << std::endl
+    << "    with --maintain, the time a single step may hold the write lock (default: 200)." << std::endl
+    << " -m, --import <path>" << std::endl
+    << "    import irssi, weechat or ZNC logs (a file or a directory, repeatable) into the backlog of --user." << std::endl
+    << " -w, --network <name>" << std::endl
+    << "    with --import, the network for all logs instead of the one in the log paths." << std::endl
+    << " -j, --jobs <count>" << std::endl
+    << "    with --import, the number of parser threads (default: one per core)." << std::endl
+    << " -z, --force" << std::endl
+    << "    with --import, also import into buffers that have lines newer than the logs (they show before the imported lines)." << std::endl
+    << " -W, --follow" << std::endl
+    << "    write the backlog lines added since the last run as JSONL and remember the last messageid." << std::endl
+    << " -t, --tail" << std::endl
+    << "    with --follow, keep running and ship new lines after every commit of the core until Ctrl-C," << std::endl
+    << "    with --sample, keep sampling until Ctrl-C." << std::endl
+    << " -o, --output <file>" << std::endl
+    << "    with --follow, append to <file> instead of writing to stdout." << std::endl
+    << " -k, --feed-file <file>" << std::endl
+    << "    the watermark of --follow (default: <database>.feed)." << std::endl
+    << " -e, --interval <ms>" << std::endl
+    << "    with --tail, how often to check for new commits (default: 1000) or to sample (default: 60000)." << std::endl
+    << " -G, --sample <file>" << std::endl
+    << "    append the size and growth of the database to a ring of JSONL samples, or rewrite <file> as" << std::endl
+    << "    Prometheus textfile if it ends in .prom, without scanning tables." << std::endl
+    << " -X, --samples <count>" << std::endl
+    << "    with --sample, the number of samples the ring keeps (default: 1440)." << std::endl
+    << " -Y, --detail" << std::endl
+    << "    with --sample, add the pages per table and index from dbstat (reads every page)." << std::endl
     << " -U, --user <username>" << std::endl
     << "    the quassel core username." << std::endl
     << " -P, --password <password>" << std::endl
@@ -302,6 +1246,7 @@ void print_usage (void) {
     << " [--help]"
     << " [--version]"
     << " [--file]"
+    << " [--config]"
     << " [--user]"
     << " [--password]"
     << " [--add]"
@@ -310,5 +1255,86 @@ void print_usage (void) {
     << " [--validate]"
     << " [--update]"
     << " [--list]"
+    << " [--export]"
+    << " [--batch]"
+    << " [--native]"
+    << " [--benchmark]"
+    << " [--simulate]"
+    << " [--gc]"
+    << " [--batch-size]"
+    << " [--index]"
+    << " [--search]"
+    << " [--quota]"
+    << " [--prune]"
+    << " [--sync]"
+    << " [--dry-run]"
+    << " [--archive]"
+    << " [--restore]"
+    << " [--maintain]"
+    << " [--import]"
+    << " [--follow]"
+    << " [--sample]"
     << std::endl;
 }
+
+/**
+ *
+ */
+qint64 parse_size(const QString& size) {
+
+  QString value = size.trimmed().toUpper();
+  qint64 factor = 1;
+
+  if( value.endsWith("K") )
+    factor = 1024;
+  else if( value.endsWith("M") )
+    factor = 1024 * 1024;
+  else if( value.endsWith("G") )
+    factor = 1024 * 1024 * 1024;
+
+  if( factor != 1 )
+    value.chop(1);
+
+  bool ok = false;
+  qint64 result = value.toLongLong(&ok);
+
+  return ( ok && result >= 0 ) ? result * factor : -1;
+}
+
+/**
+ * <days>d counts back from now, everything else is read as ISO date,
+ * returns msecs since epoch or -1
+ */
+qint64 parse_time(const QString& time) {
+
+  QString value = time.trimmed();
+
+  if( value.endsWith("d", Qt::CaseInsensitive) ) {
+    bool ok = false;
+    qint64 days = value.left(value.size() - 1).toLongLong(&ok);
+
+    return ( ok && days >= 0 ) ? QDateTime::currentDateTime().addDays(-days).toMSecsSinceEpoch() : -1;
+  }
+
+  QDateTime result = QDateTime::fromString(value, Qt::ISODate);
+
+  return result.isValid() ? result.toMSecsSinceEpoch() : -1;
+}
+
+/**
+ * the usage counters only ever add, modes that remove or restore backlog
+ * lines let the next --quota count everything again
+ */
+void invalidate_usage(const QString& usage_file) {
+
+  // no usage counters without an sqlite database
+  if( usage_file.isEmpty() )
+    return;
+
+  if( !UsageQuota::invalidate(usage_file) ) {
+    std::cerr
+      << "unable to reset the usage counters in " << usage_file.toStdString()
+      << ", run --quota with --reseed."
+      << std::endl;
+  }
+}
@@ -22,10 +22,19 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 # Input
-SOURCES += main.cpp QuasselUser.cpp
-HEADERS += QuasselUser.h
+SOURCES += main.cpp QuasselUser.cpp SqliteNative.cpp QuasselSchema.cpp Benchmark.cpp LoadSimulator.cpp GarbageCollector.cpp BacklogSearch.cpp UsageQuota.cpp UserSync.cpp BacklogArchive.cpp Maintenance.cpp CredentialIndex.cpp LogImport.cpp ChangeFeed.cpp GrowthSampler.cpp
+HEADERS += QuasselUser.h SqliteNative.h QuasselSchema.h Benchmark.h LoadSimulator.h GarbageCollector.h BacklogSearch.h UsageQuota.h UserSync.h BacklogArchive.h Maintenance.h CredentialIndex.h LogImport.h ChangeFeed.h GrowthSampler.h
 
-LIBS += -L/usr/lib64 -lqca-qt5
+LIBS += -L/usr/lib64 -lqca-qt5 -lsqlite3
+
+# the PostgreSQL backend needs libpq for COPY and pipelining
+packagesExist(libpq) {
+  CONFIG += link_pkgconfig
+  PKGCONFIG += libpq
+  DEFINES += HAVE_POSTGRESQL
+  SOURCES += PostgreSqlUser.cpp
+  HEADERS += PostgreSqlUser.h
+}
 INCLUDEPATH += /usr/include/Qca-qt5/QtCrypto
 
 QMAKE_CXXFLAGS += -std=c++0x